@@ -0,0 +1,87 @@
+// Times fillGenQueryInpFromStrCond() on a query selecting 8 columns, and the
+// column-name lookups it is made of.
+//
+//     genquery_parse_benchmark [iterations]
+
+#include "rcMisc.h"
+#include "rodsGenQuery.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+    // clang-format off
+    char query[] = "select COLL_NAME, DATA_NAME, DATA_ID, DATA_SIZE, DATA_REPL_NUM, "
+                   "DATA_RESC_HIER, DATA_CHECKSUM, DATA_MODIFY_TIME "
+                   "where COLL_NAME like '/tempZone/home/rods/%' and DATA_REPL_STATUS = '1'";
+
+    char* column_names[] = {
+        const_cast<char*>("COLL_NAME"),
+        const_cast<char*>("DATA_NAME"),
+        const_cast<char*>("DATA_ID"),
+        const_cast<char*>("DATA_SIZE"),
+        const_cast<char*>("DATA_REPL_NUM"),
+        const_cast<char*>("DATA_RESC_HIER"),
+        const_cast<char*>("DATA_CHECKSUM"),
+        const_cast<char*>("DATA_MODIFY_TIME")
+    };
+    // clang-format on
+
+    template <typename Function>
+    double nanoseconds_per_call(long _iterations, Function _func)
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (long i = 0; i < _iterations; ++i) {
+            _func();
+        }
+
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+        return elapsed.count() / _iterations;
+    }
+} // anonymous namespace
+
+int main(int _argc, char* _argv[])
+{
+    const long iterations = (_argc > 1) ? std::atol(_argv[1]) : 1000000;
+
+    if (iterations <= 0) {
+        std::fprintf(stderr, "usage: %s [iterations]\n", _argv[0]);
+        return 1;
+    }
+
+    int errors = 0;
+
+    const auto parse = nanoseconds_per_call(iterations, [&errors] {
+        genQueryInp_t input;
+        std::memset(&input, 0, sizeof(genQueryInp_t));
+
+        if (fillGenQueryInpFromStrCond(query, &input) != 0) {
+            ++errors;
+        }
+
+        clearGenQueryInp(&input);
+    });
+
+    const auto lookup = nanoseconds_per_call(iterations, [&errors] {
+        for (auto* name : column_names) {
+            if (getAttrIdFromAttrName(name) < 0) {
+                ++errors;
+            }
+        }
+    });
+
+    if (errors > 0) {
+        std::fprintf(stderr, "%d queries or column names were rejected\n", errors);
+        return 1;
+    }
+
+    std::printf("fillGenQueryInpFromStrCond (8 columns): %10.1f ns/call\n", parse);
+    std::printf("getAttrIdFromAttrName (x8):             %10.1f ns/call\n", lookup);
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+#ifndef IRODS_IO_BUFFER_POOL_HPP
+#define IRODS_IO_BUFFER_POOL_HPP
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace irods::experimental::io
+{
+    // A thread-safe cache of page-aligned buffers. Released buffers are kept
+    // for reuse, grouped by size, until the cache reaches its limit, so
+    // short-lived streams do not allocate and free large buffers over and
+    // over again.
+    class buffer_pool
+    {
+    public:
+        // A buffer on loan from the pool. It returns to the pool when
+        // destroyed.
+        class buffer
+        {
+        public:
+            buffer() noexcept
+                : pool_{}
+                , data_{}
+                , size_{}
+            {
+            }
+
+            buffer(buffer&& _other) noexcept
+                : buffer{}
+            {
+                swap(_other);
+            }
+
+            buffer& operator=(buffer&& _other) noexcept
+            {
+                buffer tmp{std::move(_other)};
+                swap(tmp);
+                return *this;
+            }
+
+            buffer(const buffer&) = delete;
+            buffer& operator=(const buffer&) = delete;
+
+            ~buffer()
+            {
+                if (data_) {
+                    pool_->release(data_, size_);
+                }
+            }
+
+            void swap(buffer& _other) noexcept
+            {
+                using std::swap;
+
+                swap(pool_, _other.pool_);
+                swap(data_, _other.data_);
+                swap(size_, _other.size_);
+            }
+
+            char* data() const noexcept
+            {
+                return data_;
+            }
+
+            std::size_t size() const noexcept
+            {
+                return size_;
+            }
+
+        private:
+            friend class buffer_pool;
+
+            buffer(buffer_pool* _pool, char* _data, std::size_t _size) noexcept
+                : pool_{_pool}
+                , data_{_data}
+                , size_{_size}
+            {
+            }
+
+            buffer_pool* pool_;
+            char* data_;
+            std::size_t size_;
+        }; // class buffer
+
+        explicit buffer_pool(std::size_t _max_cached_bytes = 64 * 1024 * 1024)
+            : max_cached_bytes_{_max_cached_bytes}
+            , cached_bytes_{}
+            , free_{}
+            , mutex_{}
+        {
+        }
+
+        buffer_pool(const buffer_pool&) = delete;
+        buffer_pool& operator=(const buffer_pool&) = delete;
+
+        // Every buffer must have been returned before the pool is destroyed.
+        ~buffer_pool()
+        {
+            for (auto& [size, buffers] : free_) {
+                for (auto* p : buffers) {
+                    std::free(p);
+                }
+            }
+        }
+
+        // Returns a buffer of at least "_size" bytes, rounded up to a whole
+        // number of pages, and aligned to a page boundary.
+        buffer acquire(std::size_t _size)
+        {
+            const auto size = round_to_page_size(std::max<std::size_t>(_size, 1));
+
+            {
+                std::lock_guard lk{mutex_};
+
+                if (auto it = free_.find(size); it != std::end(free_) && !it->second.empty()) {
+                    auto* p = it->second.back();
+                    it->second.pop_back();
+                    cached_bytes_ -= size;
+                    return {this, p, size};
+                }
+            }
+
+            void* p{};
+
+            if (::posix_memalign(&p, page_size(), size) != 0) {
+                throw std::bad_alloc{};
+            }
+
+            return {this, static_cast<char*>(p), size};
+        }
+
+        std::size_t cached_bytes() const
+        {
+            std::lock_guard lk{mutex_};
+            return cached_bytes_;
+        }
+
+        // The pool used by data object streams. It is never destroyed, so
+        // streams with static storage duration can still return buffers
+        // during program exit.
+        static buffer_pool& instance()
+        {
+            static auto* pool = new buffer_pool{};
+            return *pool;
+        }
+
+    private:
+        static std::size_t page_size() noexcept
+        {
+            static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+
+        static std::size_t round_to_page_size(std::size_t _size) noexcept
+        {
+            const auto page = page_size();
+            return (_size + page - 1) / page * page;
+        }
+
+        void release(char* _data, std::size_t _size) noexcept
+        {
+            {
+                std::lock_guard lk{mutex_};
+
+                if (cached_bytes_ + _size <= max_cached_bytes_) {
+                    try {
+                        free_[_size].push_back(_data);
+                        cached_bytes_ += _size;
+                        return;
+                    }
+                    catch (...) {
+                        // Fall through and free the buffer.
+                    }
+                }
+            }
+
+            std::free(_data);
+        }
+
+        const std::size_t max_cached_bytes_;
+        std::size_t cached_bytes_;
+        std::unordered_map<std::size_t, std::vector<char*>> free_;
+        mutable std::mutex mutex_;
+    }; // class buffer_pool
+} // namespace irods::experimental::io
+
+#endif // IRODS_IO_BUFFER_POOL_HPP
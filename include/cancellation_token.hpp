@@ -0,0 +1,38 @@
+#ifndef IRODS_CANCELLATION_TOKEN_HPP
+#define IRODS_CANCELLATION_TOKEN_HPP
+
+#include <atomic>
+#include <memory>
+
+namespace irods
+{
+    // A shared flag used to ask long-running work to stop early. Copies of a
+    // token share the same state, so one copy can be handed to the work and
+    // another kept by whoever may cancel it.
+    //
+    // Cancellation is cooperative: work checks the token at convenient
+    // points (e.g. between pages of query results) and stops there.
+    class cancellation_token
+    {
+    public:
+        cancellation_token()
+            : cancelled_{std::make_shared<std::atomic<bool>>(false)}
+        {
+        }
+
+        void cancel() noexcept
+        {
+            cancelled_->store(true);
+        }
+
+        bool cancelled() const noexcept
+        {
+            return cancelled_->load();
+        }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> cancelled_;
+    }; // class cancellation_token
+} // namespace irods
+
+#endif // IRODS_CANCELLATION_TOKEN_HPP
@@ -0,0 +1,745 @@
+#ifndef IRODS_COLUMNAR_EXPORT_HPP
+#define IRODS_COLUMNAR_EXPORT_HPP
+
+#include "query.hpp"
+#include "typed_query.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// A column-oriented file format for query results that can be loaded by
+// memory-mapping it, without parsing.
+//
+// All integers are 64-bit and native-endian, and every section starts on an
+// 8-byte boundary.
+//
+//     header      magic, version, column count, row count, chunk count,
+//                 offset of the index
+//     chunks      one per appended page. For each integer column, the values
+//                 as unsigned integers. For each text column, the offsets of
+//                 the values (rows + 1 entries, relative to the first value)
+//                 followed by the values, each terminated by a null byte.
+//     index       for each column, its type, the length of its name and the
+//                 name. For each chunk, its first row, its row count and the
+//                 offset of every column in it.
+//
+// Columns for which genquery::is_integer_column() holds are integer columns.
+// As in genquery::select_query, NULL values in them are read back as 0.
+namespace irods
+{
+    namespace columnar
+    {
+        inline constexpr char magic[8] = {'I', 'R', 'O', 'D', 'S', 'C', 'O', 'L'};
+        inline constexpr std::uint64_t version = 2;
+
+        // clang-format off
+        enum class column_type : std::uint64_t
+        {
+            text    = 0,
+            integer = 1
+        };
+        // clang-format on
+
+        struct file_header
+        {
+            char magic[8];
+            std::uint64_t version;
+            std::uint64_t column_count;
+            std::uint64_t row_count;
+            std::uint64_t chunk_count;
+            std::uint64_t index_offset;
+        };
+
+        inline std::uint64_t padding(std::uint64_t _size) noexcept
+        {
+            return (8 - _size % 8) % 8;
+        }
+    } // namespace columnar
+
+    // Writes pages of query results to a columnar file. Pages may be
+    // appended from several threads at once.
+    //
+    //     irods::columnar_writer w{"snapshot.col", {"DATA_ID", "DATA_SIZE"}};
+    //     irods::query<rcComm_t> q{&comm, "select DATA_ID, DATA_SIZE"};
+    //     irods::export_query(q, w);
+    //     w.close();
+    //
+    // With a query_processor, append each page from a batch job:
+    //
+    //     using processor = irods::query_processor<rcComm_t>;
+    //     processor qp{sql, [&w](const processor::page_view& _page) { w.append_page(_page); }};
+    class columnar_writer
+    {
+    public:
+        columnar_writer(const std::string& _path, std::vector<std::string> _column_names)
+            : file_{std::fopen(_path.c_str(), "wb")}
+            , column_names_{std::move(_column_names)}
+            , column_types_{}
+            , chunks_{}
+            , row_count_{}
+            , position_{}
+            , integers_{}
+            , offsets_{}
+            , data_{}
+            , mutex_{}
+        {
+            if (!file_) {
+                throw std::runtime_error{"cannot open [" + _path + "]: " + std::strerror(errno)};
+            }
+
+            if (column_names_.empty()) {
+                std::fclose(file_);
+                throw std::runtime_error{"columnar export requires at least one column"};
+            }
+
+            column_types_.reserve(column_names_.size());
+
+            for (const auto& name : column_names_) {
+                const auto id = getAttrIdFromAttrName(const_cast<char*>(name.c_str()));
+                column_types_.push_back(id >= 0 && experimental::genquery::is_integer_column(id)
+                                        ? columnar::column_type::integer
+                                        : columnar::column_type::text);
+            }
+
+            // The header is rewritten with the final counts on close().
+            write_header();
+        }
+
+        columnar_writer(const columnar_writer&) = delete;
+        columnar_writer& operator=(const columnar_writer&) = delete;
+
+        ~columnar_writer()
+        {
+            try {
+                close();
+            }
+            catch (...) {
+            }
+        }
+
+        // Appends a page of rows as one chunk. "_page[row][column]" must be
+        // convertible to std::string_view, which holds for a
+        // query::page_view and for a vector of rows of strings.
+        //
+        // Throws if a row does not have one value per column, or if a value
+        // of an integer column is not an unsigned integer. Nothing is written
+        // in that case. Empty values, which GenQuery returns for NULL, are
+        // stored as 0 in integer columns.
+        template <typename Page>
+        void append_page(const Page& _page)
+        {
+            const std::size_t rows = _page.size();
+
+            if (rows == 0) {
+                return;
+            }
+
+            std::lock_guard lk{mutex_};
+
+            throw_if_closed();
+
+            // A page from a query selecting fewer columns would otherwise be
+            // read past the end of its rows.
+            for (std::size_t row = 0; row < rows; ++row) {
+                if (_page[row].size() != column_names_.size()) {
+                    throw std::runtime_error{"page has " + std::to_string(_page[row].size()) + " columns but " +
+                                             std::to_string(column_names_.size()) + " were expected"};
+                }
+            }
+
+            chunk c{row_count_, rows, {}};
+            c.column_offsets.reserve(column_names_.size());
+
+            // Integer columns are converted up front so that a bad value does
+            // not leave a partial chunk behind.
+            integers_.clear();
+
+            for (std::size_t col = 0; col < column_names_.size(); ++col) {
+                if (column_types_[col] == columnar::column_type::integer) {
+                    for (std::size_t row = 0; row < rows; ++row) {
+                        integers_.push_back(to_integer(col, _page[row][col]));
+                    }
+                }
+            }
+
+            const auto* integers = integers_.data();
+
+            for (std::size_t col = 0; col < column_names_.size(); ++col) {
+                c.column_offsets.push_back(position_);
+
+                if (column_types_[col] == columnar::column_type::integer) {
+                    write(integers, rows * sizeof(std::uint64_t));
+                    integers += rows;
+                    continue;
+                }
+
+                offsets_.clear();
+                data_.clear();
+
+                for (std::size_t row = 0; row < rows; ++row) {
+                    const std::string_view value = _page[row][col];
+                    offsets_.push_back(data_.size());
+                    data_.append(value.data(), value.size());
+                    data_ += '\0';
+                }
+
+                offsets_.push_back(data_.size());
+                data_.append(columnar::padding(data_.size()), '\0');
+
+                write(offsets_.data(), offsets_.size() * sizeof(std::uint64_t));
+                write(data_.data(), data_.size());
+            }
+
+            chunks_.push_back(std::move(c));
+            row_count_ += rows;
+        }
+
+        // Writes the index and the final header. Further appends fail.
+        void close()
+        {
+            std::lock_guard lk{mutex_};
+
+            if (!file_) {
+                return;
+            }
+
+            const auto index_offset = position_;
+
+            for (std::size_t col = 0; col < column_names_.size(); ++col) {
+                const auto& name = column_names_[col];
+                write_u64(static_cast<std::uint64_t>(column_types_[col]));
+                write_u64(name.size());
+                write(name.data(), name.size());
+                write(std::string(columnar::padding(name.size()), '\0').data(), columnar::padding(name.size()));
+            }
+
+            for (const auto& c : chunks_) {
+                write_u64(c.first_row);
+                write_u64(c.row_count);
+
+                for (auto offset : c.column_offsets) {
+                    write_u64(offset);
+                }
+            }
+
+            if (std::fseek(file_, 0, SEEK_SET) != 0) {
+                fail("cannot seek to header");
+            }
+
+            position_ = 0;
+            write_header(index_offset);
+
+            const auto ec = std::fclose(file_);
+            file_ = nullptr;
+
+            if (ec != 0) {
+                throw std::runtime_error{std::string{"cannot close columnar file: "} + std::strerror(errno)};
+            }
+        }
+
+    private:
+        struct chunk
+        {
+            std::uint64_t first_row;
+            std::uint64_t row_count;
+            std::vector<std::uint64_t> column_offsets;
+        };
+
+        void write_header(std::uint64_t _index_offset = 0)
+        {
+            columnar::file_header h{};
+            std::copy(std::begin(columnar::magic), std::end(columnar::magic), h.magic);
+            h.version = columnar::version;
+            h.column_count = column_names_.size();
+            h.row_count = row_count_;
+            h.chunk_count = chunks_.size();
+            h.index_offset = _index_offset;
+
+            write(&h, sizeof(h));
+        }
+
+        std::uint64_t to_integer(std::size_t _column_idx, std::string_view _value) const
+        {
+            // GenQuery returns an empty string for NULL values.
+            if (_value.empty()) {
+                return 0;
+            }
+
+            std::uint64_t v{};
+            const auto* last = _value.data() + _value.size();
+            const auto [p, ec] = std::from_chars(_value.data(), last, v);
+
+            if (ec != std::errc{} || p != last) {
+                throw std::runtime_error{"column [" + column_names_[_column_idx] + "] holds a non-integer value [" +
+                                         std::string{_value} + "]"};
+            }
+
+            return v;
+        }
+
+        void write_u64(std::uint64_t _value)
+        {
+            write(&_value, sizeof(_value));
+        }
+
+        void write(const void* _data, std::size_t _size)
+        {
+            if (_size > 0 && std::fwrite(_data, 1, _size, file_) != _size) {
+                fail("cannot write columnar file");
+            }
+
+            position_ += _size;
+        }
+
+        void throw_if_closed() const
+        {
+            if (!file_) {
+                throw std::runtime_error{"columnar file is closed"};
+            }
+        }
+
+        [[noreturn]] void fail(const char* _msg)
+        {
+            const std::string msg = std::string{_msg} + ": " + std::strerror(errno);
+            std::fclose(file_);
+            file_ = nullptr;
+            throw std::runtime_error{msg};
+        }
+
+        std::FILE* file_;
+        const std::vector<std::string> column_names_;
+        std::vector<columnar::column_type> column_types_;
+        std::vector<chunk> chunks_;
+        std::uint64_t row_count_;
+        std::uint64_t position_;
+
+        // Reused between pages.
+        std::vector<std::uint64_t> integers_;
+        std::vector<std::uint64_t> offsets_;
+        std::string data_;
+
+        std::mutex mutex_;
+    }; // class columnar_writer
+
+    // Writes every remaining page of "_query" to "_writer".
+    template <typename connection_type>
+    void export_query(query<connection_type>& _query, columnar_writer& _writer)
+    {
+        _query.for_each_page([&_writer](const auto& _page) {
+            _writer.append_page(_page);
+        });
+    }
+
+    // A read-only, memory-mapped view of a columnar file. Text values are
+    // std::string_views into the mapping and stay valid for the lifetime of
+    // the reader. Each one written by columnar_writer is followed by a null
+    // byte.
+    //
+    // The index and the offset table of every chunk are checked when the
+    // file is loaded, so a truncated or corrupt file is rejected rather than
+    // read past the end of the mapping.
+    class columnar_reader
+    {
+    private:
+        struct chunk
+        {
+            std::uint64_t first_row;
+            std::uint64_t row_count;
+            const std::uint64_t* column_offsets;
+        };
+
+    public:
+        // The values of one column, in row order. "T" is std::string_view for
+        // a text column and std::uint64_t for an integer column.
+        template <typename T>
+        class basic_column_view
+        {
+        public:
+            class iterator
+            {
+            public:
+                using value_type        = T;
+                using pointer           = const T*;
+                using reference         = T;
+                using difference_type   = std::ptrdiff_t;
+                using iterator_category = std::forward_iterator_tag;
+
+                iterator(const basic_column_view* _column, std::size_t _chunk_idx) noexcept
+                    : column_{_column}
+                    , chunk_idx_{_chunk_idx}
+                    , row_idx_{}
+                {
+                }
+
+                T operator*() const noexcept
+                {
+                    return column_->value(chunk_idx_, row_idx_);
+                }
+
+                iterator& operator++() noexcept
+                {
+                    if (++row_idx_ == column_->reader_->chunks_[chunk_idx_].row_count) {
+                        ++chunk_idx_;
+                        row_idx_ = 0;
+                    }
+
+                    return *this;
+                }
+
+                iterator operator++(int) noexcept
+                {
+                    auto it = *this;
+                    ++(*this);
+                    return it;
+                }
+
+                bool operator==(const iterator& _rhs) const noexcept
+                {
+                    return chunk_idx_ == _rhs.chunk_idx_ && row_idx_ == _rhs.row_idx_;
+                }
+
+                bool operator!=(const iterator& _rhs) const noexcept
+                {
+                    return !(*this == _rhs);
+                }
+
+            private:
+                const basic_column_view* column_;
+                std::size_t chunk_idx_;
+                std::uint64_t row_idx_;
+            }; // class iterator
+
+            basic_column_view(const columnar_reader* _reader, std::size_t _column_idx) noexcept
+                : reader_{_reader}
+                , column_idx_{_column_idx}
+            {
+            }
+
+            std::size_t size() const noexcept
+            {
+                return reader_->row_count();
+            }
+
+            // Random access by row. Finds the chunk with a binary search.
+            // Throws std::out_of_range if "_row" is not less than size().
+            T operator[](std::size_t _row) const
+            {
+                if (_row >= size()) {
+                    throw std::out_of_range{"row index out of range"};
+                }
+
+                const auto& chunks = reader_->chunks_;
+                const auto it = std::upper_bound(std::begin(chunks), std::end(chunks), _row, [](std::size_t _r, const chunk& _c) {
+                    return _r < _c.first_row;
+                });
+
+                // The first chunk starts at row 0, so "it" is never the first.
+                const auto chunk_idx = static_cast<std::size_t>(std::distance(std::begin(chunks), it)) - 1;
+
+                return value(chunk_idx, _row - chunks[chunk_idx].first_row);
+            }
+
+            iterator begin() const noexcept
+            {
+                return {this, 0};
+            }
+
+            iterator end() const noexcept
+            {
+                return {this, reader_->chunks_.size()};
+            }
+
+        private:
+            T value(std::size_t _chunk_idx, std::uint64_t _row_idx) const noexcept
+            {
+                const auto& c = reader_->chunks_[_chunk_idx];
+                const auto* values = reinterpret_cast<const std::uint64_t*>(reader_->base_ + c.column_offsets[column_idx_]);
+
+                if constexpr (std::is_same_v<T, std::uint64_t>) {
+                    return values[_row_idx];
+                }
+                else {
+                    const auto* data = reinterpret_cast<const char*>(values + c.row_count + 1);
+
+                    // Excludes the null terminator.
+                    return {data + values[_row_idx], values[_row_idx + 1] - values[_row_idx] - 1};
+                }
+            }
+
+            const columnar_reader* reader_;
+            std::size_t column_idx_;
+        }; // class basic_column_view
+
+        using column_view         = basic_column_view<std::string_view>;
+        using integer_column_view = basic_column_view<std::uint64_t>;
+
+        explicit columnar_reader(const std::string& _path)
+            : base_{}
+            , size_{}
+            , header_{}
+            , column_types_{}
+            , column_names_{}
+            , chunks_{}
+        {
+            const int fd = ::open(_path.c_str(), O_RDONLY);
+
+            if (fd < 0) {
+                throw std::runtime_error{"cannot open [" + _path + "]: " + std::strerror(errno)};
+            }
+
+            struct stat st{};
+
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error{"cannot stat [" + _path + "]: " + std::strerror(errno)};
+            }
+
+            size_ = static_cast<std::size_t>(st.st_size);
+
+            if (size_ < sizeof(columnar::file_header)) {
+                ::close(fd);
+                throw std::runtime_error{"[" + _path + "] is not a columnar file"};
+            }
+
+            void* p = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+
+            if (p == MAP_FAILED) {
+                throw std::runtime_error{"cannot map [" + _path + "]: " + std::strerror(errno)};
+            }
+
+            base_ = static_cast<const char*>(p);
+
+            try {
+                load_index(_path);
+            }
+            catch (...) {
+                ::munmap(const_cast<char*>(base_), size_);
+                throw;
+            }
+
+            // Columns are usually scanned front to back.
+            ::madvise(const_cast<char*>(base_), size_, MADV_SEQUENTIAL);
+        }
+
+        columnar_reader(const columnar_reader&) = delete;
+        columnar_reader& operator=(const columnar_reader&) = delete;
+
+        ~columnar_reader()
+        {
+            ::munmap(const_cast<char*>(base_), size_);
+        }
+
+        std::size_t row_count() const noexcept
+        {
+            return header_->row_count;
+        }
+
+        std::size_t column_count() const noexcept
+        {
+            return header_->column_count;
+        }
+
+        std::string_view column_name(std::size_t _column_idx) const
+        {
+            return column_names_.at(_column_idx);
+        }
+
+        bool is_integer_column(std::size_t _column_idx) const
+        {
+            return column_types_.at(_column_idx) == columnar::column_type::integer;
+        }
+
+        // Throws if the column is an integer column.
+        column_view column(std::size_t _column_idx) const
+        {
+            throw_if_not(_column_idx, columnar::column_type::text);
+            return {this, _column_idx};
+        }
+
+        // Throws if the column is a text column.
+        integer_column_view integer_column(std::size_t _column_idx) const
+        {
+            throw_if_not(_column_idx, columnar::column_type::integer);
+            return {this, _column_idx};
+        }
+
+    private:
+        void throw_if_not(std::size_t _column_idx, columnar::column_type _type) const
+        {
+            if (_column_idx >= column_count()) {
+                throw std::out_of_range{"column index out of range"};
+            }
+
+            if (column_types_[_column_idx] != _type) {
+                const auto* kind = (columnar::column_type::integer == _type) ? "an integer" : "a text";
+                throw std::invalid_argument{"column [" + std::string{column_names_[_column_idx]} + "] is not " + kind + " column"};
+            }
+        }
+
+        void load_index(const std::string& _path)
+        {
+            const auto invalid = [&_path] {
+                return std::runtime_error{"[" + _path + "] is not a valid columnar file"};
+            };
+
+            constexpr auto word = sizeof(std::uint64_t);
+
+            header_ = reinterpret_cast<const columnar::file_header*>(base_);
+
+            if (!std::equal(std::begin(columnar::magic), std::end(columnar::magic), header_->magic) ||
+                header_->version != columnar::version ||
+                header_->column_count == 0 ||
+                header_->index_offset < sizeof(columnar::file_header) ||
+                header_->index_offset > size_ ||
+                header_->index_offset % word != 0)
+            {
+                throw invalid();
+            }
+
+            const auto* pos = base_ + header_->index_offset;
+            const auto* const end = base_ + size_;
+
+            const auto remaining = [&] {
+                return static_cast<std::uint64_t>(end - pos);
+            };
+
+            const auto read_u64 = [&] {
+                if (remaining() < word) {
+                    throw invalid();
+                }
+
+                const auto v = *reinterpret_cast<const std::uint64_t*>(pos);
+                pos += word;
+                return v;
+            };
+
+            // Each column takes at least its type and the length of its name,
+            // which bounds the counts before anything is reserved.
+            if (header_->column_count > remaining() / (2 * word)) {
+                throw invalid();
+            }
+
+            column_types_.reserve(header_->column_count);
+            column_names_.reserve(header_->column_count);
+
+            for (std::uint64_t i = 0; i < header_->column_count; ++i) {
+                const auto type = static_cast<columnar::column_type>(read_u64());
+
+                if (type != columnar::column_type::text && type != columnar::column_type::integer) {
+                    throw invalid();
+                }
+
+                const auto length = read_u64();
+
+                if (length > remaining() || columnar::padding(length) > remaining() - length) {
+                    throw invalid();
+                }
+
+                column_types_.push_back(type);
+                column_names_.emplace_back(pos, length);
+                pos += length + columnar::padding(length);
+            }
+
+            // Each chunk takes its first row, its row count and one offset per
+            // column.
+            if (header_->chunk_count > remaining() / ((header_->column_count + 2) * word)) {
+                throw invalid();
+            }
+
+            chunks_.reserve(header_->chunk_count);
+
+            std::uint64_t rows = 0;
+
+            for (std::uint64_t i = 0; i < header_->chunk_count; ++i) {
+                const auto first_row = read_u64();
+                const auto row_count = read_u64();
+                const auto* offsets = reinterpret_cast<const std::uint64_t*>(pos);
+
+                // Chunks follow each other without gaps, so the iterators and
+                // the search in operator[] can rely on the row numbers.
+                if (first_row != rows || row_count == 0) {
+                    throw invalid();
+                }
+
+                for (std::uint64_t col = 0; col < header_->column_count; ++col) {
+                    if (!is_valid_column(read_u64(), row_count, column_types_[col])) {
+                        throw invalid();
+                    }
+                }
+
+                chunks_.push_back({first_row, row_count, offsets});
+                rows += row_count;
+            }
+
+            if (rows != header_->row_count) {
+                throw invalid();
+            }
+        }
+
+        // Checks that a column of a chunk lies between the header and the
+        // index. For a text column, also checks that the offsets of its values
+        // increase and that the last one stays within it.
+        bool is_valid_column(std::uint64_t _offset, std::uint64_t _row_count, columnar::column_type _type) const noexcept
+        {
+            constexpr auto word = sizeof(std::uint64_t);
+            const std::uint64_t limit = header_->index_offset;
+
+            if (_offset < sizeof(columnar::file_header) || _offset > limit || _offset % word != 0) {
+                return false;
+            }
+
+            const auto words = (limit - _offset) / word;
+
+            if (columnar::column_type::integer == _type) {
+                return _row_count <= words;
+            }
+
+            if (_row_count >= words) {
+                return false;
+            }
+
+            const auto* offsets = reinterpret_cast<const std::uint64_t*>(base_ + _offset);
+            const auto data_size = limit - _offset - (_row_count + 1) * word;
+
+            if (offsets[0] != 0) {
+                return false;
+            }
+
+            // Every value is followed by a null byte, so no two offsets are
+            // equal.
+            for (std::uint64_t row = 0; row < _row_count; ++row) {
+                if (offsets[row + 1] <= offsets[row]) {
+                    return false;
+                }
+            }
+
+            return offsets[_row_count] <= data_size;
+        }
+
+        const char* base_;
+        std::size_t size_;
+        const columnar::file_header* header_;
+        std::vector<columnar::column_type> column_types_;
+        std::vector<std::string_view> column_names_;
+        std::vector<chunk> chunks_;
+    }; // class columnar_reader
+} // namespace irods
+
+#endif // IRODS_COLUMNAR_EXPORT_HPP
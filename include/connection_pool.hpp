@@ -3,18 +3,87 @@
 
 #include "rcConnect.h"
 
+#include <array>
 #include <memory>
 #include <vector>
+#include <deque>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
 #include <string>
 #include <functional>
+#include <thread>
 
 namespace irods
 {
+    class thread_pool;
+
+    // A point-in-time view of the activity of a connection pool.
+    struct connection_pool_metrics
+    {
+        // Bucket "i" counts durations in the range [2^(i-1), 2^i) microseconds.
+        // Bucket zero counts durations under one microsecond and the last
+        // bucket also counts everything longer than its range.
+        inline static constexpr std::size_t histogram_size = 32;
+
+        using histogram = std::array<std::uint64_t, histogram_size>;
+
+        histogram wait_time{};  // Time spent waiting for a connection.
+        histogram hold_time{};  // Time a connection was checked out.
+
+        int connections_in_use{};
+        int connections_idle{};
+        int waiting_threads{};
+
+        std::uint64_t checkouts{};
+        std::uint64_t refresh_reconnects{};  // Reconnects caused by the refresh time.
+        std::uint64_t connect_failures{};
+        std::uint64_t login_failures{};
+    };
+
+    struct connection_pool_options
+    {
+        // When enabled, connections are validated by a background thread
+        // instead of on every call to get_connection(). Checking out a
+        // connection then only compares its age against the refresh time.
+        bool background_health_check = false;
+
+        // How often the background thread inspects idle connections. This
+        // also controls how often idle connections are reaped.
+        std::chrono::seconds health_check_interval{10};
+
+        // Idle connections that have not been used for at least this long
+        // are verified with a query by the background thread.
+        std::chrono::seconds verify_after_idle{60};
+
+        // The maximum number of connections the pool may grow to. The size
+        // passed to the pool's constructor is the number of connections kept
+        // warm at all times. Zero means the pool never grows.
+        int max_size = 0;
+
+        // Connections above the minimum size that have been idle for at least
+        // this long are closed.
+        std::chrono::seconds idle_timeout{300};
+
+        // When enabled, a thread is given the connection it used last if that
+        // connection is free. Otherwise, the thread scans the pool starting at
+        // a thread-specific position instead of at the first connection.
+        bool thread_affinity = false;
+
+        // When set, invoked by the background thread with a snapshot of the
+        // pool's metrics every "metrics_interval".
+        std::function<void(const connection_pool_metrics&)> metrics_callback{};
+        std::chrono::seconds metrics_interval{60};
+    };
+
     class connection_pool
     {
     public:
+        using clock_type = std::chrono::steady_clock;
+
         // A wrapper around a connection in the pool.
         // On destruction, the underlying connection is immediately returned
         // to the pool.
@@ -30,14 +99,28 @@ namespace irods
 
             operator rcComm_t&() const noexcept;
 
+            // Returns how long the caller waited for this connection to
+            // become available.
+            clock_type::duration wait_time() const noexcept;
+
+            // Informs the pool that a network error occurred on this
+            // connection. The connection will be verified before it is
+            // handed out again.
+            void report_socket_error() noexcept;
+
         private:
-            connection_proxy(connection_pool& _pool, rcComm_t& _conn, int _index) noexcept;
+            connection_proxy(connection_pool& _pool,
+                             rcComm_t& _conn,
+                             int _index,
+                             clock_type::duration _wait_time) noexcept;
 
             static constexpr int uninitialized_index = -1;
 
             connection_pool* pool_;
             rcComm_t* conn_;
             int index_;
+            clock_type::duration wait_time_;
+            clock_type::time_point checkout_time_;
         };
 
         connection_pool(int _size,
@@ -47,21 +130,53 @@ namespace irods
                         const std::string& _zone,
                         const int _refresh_time);
 
+        connection_pool(int _size,
+                        const std::string& _host,
+                        const int _port,
+                        const std::string& _username,
+                        const std::string& _zone,
+                        const int _refresh_time,
+                        const connection_pool_options& _options);
+
         connection_pool(const connection_pool&) = delete;
         connection_pool& operator=(const connection_pool&) = delete;
 
+        ~connection_pool();
+
+        // Blocks until a connection is available. Waiting threads are served
+        // in the order in which they arrived.
+        //
+        // If the pool tries to grow on behalf of a waiting thread and cannot
+        // connect, that thread throws instead of waiting any longer.
         connection_proxy get_connection();
 
+        // Blocks until a connection is available or "_timeout" has elapsed.
+        // Returns an empty optional on timeout. A failed attempt to grow the
+        // pool does not end the wait early.
+        std::optional<connection_proxy> get_connection(clock_type::duration _timeout);
+
+        // Returns a connection only if one is available without waiting.
+        std::optional<connection_proxy> try_get_connection();
+
+        // Returns a snapshot of the pool's metrics.
+        connection_pool_metrics metrics() const;
+
     private:
         using connection_pointer = std::unique_ptr<rcComm_t, int(*)(rcComm_t*)>;
 
-        struct connection_context
+        inline static constexpr std::size_t cache_line_size = 64;
+
+        // Each context occupies its own cache line(s) so that threads claiming
+        // neighboring connections do not contend on the same line.
+        struct alignas(cache_line_size) connection_context
         {
-            std::mutex mutex{};
             std::atomic<bool> in_use{};
+            bool vacant{};
             connection_pointer conn{nullptr, rcDisconnect};
             rErrMsg_t error{};
             std::time_t creation_time{};
+            clock_type::time_point last_used_time{};
+            bool socket_error{};
         };
 
         void create_connection(int _index,
@@ -72,14 +187,85 @@ namespace irods
 
         bool verify_connection(int _index);
 
+        bool connection_expired(int _index) const noexcept;
+
+        bool connection_healthy(int _index);
+
+        void run_maintenance();
+
+        void check_idle_connections();
+
+        bool elastic() const noexcept;
+
+        void grow_if_needed();
+
+        bool reap_if_idle(int _index);
+
+        // A thread blocked in get_connection(). Released connections are
+        // handed directly to the waiter at the front of the queue.
+        struct waiter
+        {
+            std::condition_variable cv{};
+            int index = connection_proxy::uninitialized_index;
+            bool connect_failed = false;
+            bool timed = false;  // Never fails with connect_failed.
+        };
+
+        bool try_claim_connection(int _index) noexcept;
+
+        int acquire_idle_connection() noexcept;
+
+        int acquire_connection(const std::optional<clock_type::time_point>& _deadline);
+
+        connection_proxy make_connection_proxy(int _index, clock_type::duration _wait_time);
+
+        void release_connection(int _index, clock_type::time_point _checkout_time);
+
         void return_connection(int _index);
 
+        // Atomic counterparts of the counters in connection_pool_metrics. These
+        // are updated without locking on every checkout.
+        struct metric_counters
+        {
+            using histogram = std::array<std::atomic<std::uint64_t>, connection_pool_metrics::histogram_size>;
+
+            histogram wait_time{};
+            histogram hold_time{};
+            std::atomic<std::uint64_t> checkouts{};
+            std::atomic<std::uint64_t> refresh_reconnects{};
+            std::atomic<std::uint64_t> connect_failures{};
+            std::atomic<std::uint64_t> login_failures{};
+        };
+
+        static void record_duration(metric_counters::histogram& _hist, clock_type::duration _duration) noexcept;
+
         const std::string host_;
         const int port_;
         const std::string username_;
         const std::string zone_;
         const int refresh_time_;
+        const connection_pool_options options_;
+        const std::uint64_t id_;
         std::vector<connection_context> conn_ctxs_;
+
+        const int min_size_;
+
+        // Guards the waiter queue as well as the vacancy of connection
+        // slots and the counters below.
+        mutable std::mutex waiters_mutex_;
+        std::deque<waiter*> waiters_;
+        std::atomic<int> waiter_count_;
+        int live_count_;
+        int pending_count_;
+
+        std::unique_ptr<irods::thread_pool> growth_pool_;
+
+        metric_counters counters_;
+
+        std::mutex maintenance_mutex_;
+        std::condition_variable maintenance_cv_;
+        bool stop_maintenance_;
+        std::thread maintenance_thread_;
     };
 } // namespace irods
 
@@ -3,10 +3,11 @@
 
 #include "filesystem/path.hpp"
 #include "transport/transport.hpp"
+#include "buffer_pool.hpp"
 
 #include <streambuf>
 #include <type_traits>
-#include <array>
+#include <cstring>
 #include <string>
 #include <stdexcept>
 #include <algorithm>
@@ -14,6 +15,11 @@
 
 namespace irods::experimental::io
 {
+    // The size of the internal buffer of a data object stream unless another
+    // size is given when it is opened. Every underflow or overflow of the
+    // buffer costs one read or write API request.
+    inline constexpr std::size_t default_buffer_size = 4 * 1024 * 1024;
+
     // Details about what each virtual function in this template are required to
     // do can be found at the following link:
     //
@@ -39,8 +45,6 @@ namespace irods::experimental::io
         using base_type = std::basic_streambuf<CharT, Traits>;
 
         // clang-format off
-        inline static constexpr auto buffer_size          = 4096;
-
         // Errors
         inline static constexpr auto external_write_error = -1;
         inline static const     auto seek_error           = pos_type{off_type{-1}};
@@ -91,9 +95,13 @@ namespace irods::experimental::io
             return transport_ && transport_->is_open();
         }
 	
+        // The internal buffer holds "_buffer_size" bytes, rounded up to a
+        // whole number of pages. It is taken from buffer_pool::instance()
+        // and given back on close().
         basic_data_object_buf* open(transport<char_type>& _transport,
                                     const filesystem::path& _p,
-                                    std::ios_base::openmode _mode)
+                                    std::ios_base::openmode _mode,
+                                    std::size_t _buffer_size = default_buffer_size)
         {
             transport_ = &_transport;
 
@@ -101,7 +109,7 @@ namespace irods::experimental::io
                 return nullptr;
             }
 
-            init_get_or_put_area(_mode);
+            init_get_or_put_area(_mode, _buffer_size);
 
             return this;
         }
@@ -109,7 +117,8 @@ namespace irods::experimental::io
         basic_data_object_buf* open(transport<char_type>& _transport,
                                     const filesystem::path& _p,
                                     int _replica_number,
-                                    std::ios_base::openmode _mode)
+                                    std::ios_base::openmode _mode,
+                                    std::size_t _buffer_size = default_buffer_size)
         {
             transport_ = &_transport;
 
@@ -117,7 +126,7 @@ namespace irods::experimental::io
                 return nullptr;
             }
 
-            init_get_or_put_area(_mode);
+            init_get_or_put_area(_mode, _buffer_size);
 
             return this;
         }
@@ -125,7 +134,8 @@ namespace irods::experimental::io
         basic_data_object_buf* open(transport<char_type>& _transport,
                                     const filesystem::path& _p,
                                     const std::string& _resource_name,
-                                    std::ios_base::openmode _mode)
+                                    std::ios_base::openmode _mode,
+                                    std::size_t _buffer_size = default_buffer_size)
         {
             transport_ = &_transport;
 
@@ -133,7 +143,7 @@ namespace irods::experimental::io
                 return nullptr;
             }
 
-            init_get_or_put_area(_mode);
+            init_get_or_put_area(_mode, _buffer_size);
 
             return this;
         }
@@ -154,9 +164,19 @@ namespace irods::experimental::io
                 sb = nullptr;
             }
 
+            // Return the buffer to the pool.
+            this->setg(nullptr, nullptr, nullptr);
+            this->setp(nullptr, nullptr);
+            buf_ = {};
+
             return sb;
         }
 
+        std::size_t buffer_size() const noexcept
+        {
+            return buf_.size() / sizeof(char_type);
+        }
+
         int file_descriptor() const noexcept
         {
             return transport_->file_descriptor();;
@@ -176,13 +196,13 @@ namespace irods::experimental::io
             // The "Get" area has been consumed. Fill the internal buffer with
             // new data from the data object.
 
-            const auto bytes_read = transport_->receive(buf_.data(), buf_.size() * sizeof(char_type));
+            const auto bytes_read = transport_->receive(buffer_data(), buf_.size());
 
             if (bytes_read <= 0) {
                 return traits_type::eof();
             }
 
-            auto* pbase = buf_.data();
+            auto* pbase = buffer_data();
             this->setg(pbase, pbase, pbase + bytes_read);
 
             return traits_type::to_int_type(*this->gptr());
@@ -292,7 +312,7 @@ namespace irods::experimental::io
             this->setp(nullptr, nullptr);
 
             // Setup the "Get" area.
-            auto* pbase = buf_.data();
+            auto* pbase = buffer_data();
             this->setg(pbase, pbase, pbase);
         }
 
@@ -307,14 +327,26 @@ namespace irods::experimental::io
             this->setg(nullptr, nullptr, nullptr);
 
             // Setup the "Put" area.
-            auto* pbase = buf_.data();
-            this->setp(pbase, pbase + buf_.size());
+            auto* pbase = buffer_data();
+            this->setp(pbase, pbase + buffer_size());
+        }
+
+        char_type* buffer_data() const noexcept
+        {
+            return reinterpret_cast<char_type*>(buf_.data());
         }
 
-        void init_get_or_put_area(std::ios_base::openmode _mode) noexcept
+        void init_get_or_put_area(std::ios_base::openmode _mode, std::size_t _buffer_size)
         {
             using std::ios_base;
 
+            if (!buf_.data() || buf_.size() < _buffer_size * sizeof(char_type)) {
+                // Drop any areas pointing into the previous buffer.
+                this->setg(nullptr, nullptr, nullptr);
+                this->setp(nullptr, nullptr);
+                buf_ = buffer_pool::instance().acquire(_buffer_size * sizeof(char_type));
+            }
+
             const auto m = ios_base::in | ios_base::out;
 
             if ((_mode & m) == m || _mode & ios_base::in) {
@@ -333,7 +365,7 @@ namespace irods::experimental::io
                 return 0;
             }
 
-            const auto bytes_written = transport_->send(buf_.data(), bytes_to_send * sizeof(char_type));
+            const auto bytes_written = transport_->send(buffer_data(), bytes_to_send * sizeof(char_type));
 
             if (bytes_written < 0) {
                 return external_write_error;
@@ -344,7 +376,7 @@ namespace irods::experimental::io
             return 0;
         }
 
-        std::array<char_type, buffer_size> buf_;
+        buffer_pool::buffer buf_;
         transport<char_type>* transport_;
     }; // basic_data_object_buf
 
@@ -401,28 +433,31 @@ namespace irods::experimental::io
 
         basic_dstream(transport<char_type>& _transport,
                       const filesystem::path& _p,
-                      std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                      std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                      std::size_t _buffer_size = default_buffer_size)
             : basic_dstream{}
         {
-            open(_transport, _p, _mode);
+            open(_transport, _p, _mode, _buffer_size);
         }
 
         basic_dstream(transport<char_type>& _transport,
                       const filesystem::path& _p,
                       int _replica_number,
-                      std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                      std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                      std::size_t _buffer_size = default_buffer_size)
             : basic_dstream{}
         {
-            open(_transport, _p, _replica_number, _mode);
+            open(_transport, _p, _replica_number, _mode, _buffer_size);
         }
 
         basic_dstream(transport<char_type>& _transport,
                       const filesystem::path& _p,
                       const std::string& _resource_name,
-                      std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                      std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                      std::size_t _buffer_size = default_buffer_size)
             : basic_dstream{}
         {
-            open(_transport, _p, _resource_name, _mode);
+            open(_transport, _p, _resource_name, _mode, _buffer_size);
         }
 
         basic_dstream(basic_dstream&& _other)
@@ -464,9 +499,10 @@ namespace irods::experimental::io
 
         void open(transport<char_type>& _transport,
                   const filesystem::path& _p,
-                  std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                  std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                  std::size_t _buffer_size = default_buffer_size)
         {
-            if (!buf_.open(_transport, _p, _mode | mandatory_openmode<GeneralStream>)) {
+            if (!buf_.open(_transport, _p, _mode | mandatory_openmode<GeneralStream>, _buffer_size)) {
                 this->setstate(std::ios_base::failbit);
             }
             else {
@@ -477,9 +513,10 @@ namespace irods::experimental::io
         void open(transport<char_type>& _transport,
                   const filesystem::path& _p,
                   int _replica_number,
-                  std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                  std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                  std::size_t _buffer_size = default_buffer_size)
         {
-            if (!buf_.open(_transport, _p, _replica_number, _mode | mandatory_openmode<GeneralStream>)) {
+            if (!buf_.open(_transport, _p, _replica_number, _mode | mandatory_openmode<GeneralStream>, _buffer_size)) {
                 this->setstate(std::ios_base::failbit);
             }
             else {
@@ -490,9 +527,10 @@ namespace irods::experimental::io
         void open(transport<char_type>& _transport,
                   const filesystem::path& _p,
                   const std::string& _resource_name,
-                  std::ios_base::openmode _mode = default_openmode<GeneralStream>)
+                  std::ios_base::openmode _mode = default_openmode<GeneralStream>,
+                  std::size_t _buffer_size = default_buffer_size)
         {
-            if (!buf_.open(_transport, _p, _resource_name, _mode | mandatory_openmode<GeneralStream>)) {
+            if (!buf_.open(_transport, _p, _resource_name, _mode | mandatory_openmode<GeneralStream>, _buffer_size)) {
                 this->setstate(std::ios_base::failbit);
             }
             else {
@@ -0,0 +1,199 @@
+#ifndef IRODS_PREPARED_QUERY_HPP
+#define IRODS_PREPARED_QUERY_HPP
+
+#include "query.hpp"
+#include "irods_exception.hpp"
+#include "rcMisc.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace irods
+{
+    // A general query that is parsed once and executed many times with
+    // different condition values. Condition values written as "?" are
+    // placeholders, numbered from zero in the order they appear.
+    //
+    //     prepared_query q{"select DATA_NAME where COLL_NAME = ? and DATA_NAME like ?"};
+    //
+    //     q.bind(0, "/tempZone/home/rods").bind(1, "%.txt");
+    //
+    //     for (auto&& row : q.execute(&comm)) {
+    //         // ...
+    //     }
+    //
+    // Bound values are quoted when the query is executed. The query returned
+    // by execute() borrows the prepared input, so the prepared query must
+    // outlive it and must not be rebound or executed again while it is in use.
+    class prepared_query
+    {
+    public:
+        explicit prepared_query(const std::string& _query)
+            : query_{_query}
+            , input_{}
+            , conditions_{}
+            , values_{}
+            , bound_{}
+        {
+            const int ec = fillGenQueryInpFromStrCond(const_cast<char*>(_query.c_str()), &input_);
+
+            if (ec < 0) {
+                clearGenQueryInp(&input_);
+                THROW(ec, boost::format("query fill failed for [%s]") % _query);
+            }
+
+            for (int i = 0; i < input_.sqlCondInp.len; ++i) {
+                parse_condition(i);
+            }
+
+            values_.resize(bound_.size());
+        }
+
+        prepared_query(const prepared_query&) = delete;
+        prepared_query& operator=(const prepared_query&) = delete;
+
+        ~prepared_query()
+        {
+            clearGenQueryInp(&input_);
+        }
+
+        std::size_t placeholder_count() const noexcept
+        {
+            return values_.size();
+        }
+
+        // Sets the value of the placeholder at "_index". The value is copied,
+        // reusing the storage of the previous value when possible.
+        prepared_query& bind(std::size_t _index, std::string_view _value)
+        {
+            if (_index >= values_.size()) {
+                THROW(SYS_INVALID_INPUT_PARAM, "placeholder index out of range");
+            }
+
+            values_[_index].assign(_value.data(), _value.size());
+            bound_[_index] = true;
+
+            return *this;
+        }
+
+        // Writes the bound values into the prepared input and runs the query.
+        template <typename connection_type>
+        query<connection_type> execute(connection_type* _comm,
+                                       uintmax_t _query_limit = 0,
+                                       const query_options& _options = {})
+        {
+            render();
+            return query<connection_type>{_comm, input_, _query_limit, _options, query_};
+        }
+
+        const genQueryInp_t& input() const noexcept
+        {
+            return input_;
+        }
+
+    private:
+        // A condition containing at least one placeholder. "literals" holds
+        // the text around the placeholders, so a condition with N placeholders
+        // has N + 1 literals.
+        struct condition
+        {
+            int cond_idx;
+            std::size_t first_placeholder;
+            std::vector<std::string> literals;
+            std::size_t capacity;
+        };
+
+        void parse_condition(int _cond_idx)
+        {
+            const std::string_view value = input_.sqlCondInp.value[_cond_idx];
+
+            condition cond{_cond_idx, bound_.size(), {}, value.size()};
+            std::string literal;
+            bool in_quotes = false;
+
+            for (auto c : value) {
+                if (c == '\'') {
+                    in_quotes = !in_quotes;
+                }
+                else if (c == '?' && !in_quotes) {
+                    cond.literals.push_back(std::move(literal));
+                    literal.clear();
+                    bound_.push_back(false);
+                    continue;
+                }
+
+                literal += c;
+            }
+
+            if (cond.literals.empty()) {
+                return;
+            }
+
+            cond.literals.push_back(std::move(literal));
+            conditions_.push_back(std::move(cond));
+        }
+
+        void render()
+        {
+            for (auto& cond : conditions_) {
+                const auto placeholders = cond.literals.size() - 1;
+
+                std::size_t length = 0;
+                for (const auto& l : cond.literals) {
+                    length += l.size();
+                }
+
+                for (std::size_t i = 0; i < placeholders; ++i) {
+                    if (!bound_[cond.first_placeholder + i]) {
+                        THROW(SYS_INVALID_INPUT_PARAM, "placeholder has not been bound");
+                    }
+
+                    length += values_[cond.first_placeholder + i].size() + 2;
+                }
+
+                // The value is owned by the input and released with free().
+                auto*& dst = input_.sqlCondInp.value[cond.cond_idx];
+
+                if (length > cond.capacity) {
+                    auto* p = static_cast<char*>(std::realloc(dst, length + 1));
+
+                    if (!p) {
+                        THROW(SYS_MALLOC_ERR, "failed to allocate condition value");
+                    }
+
+                    dst = p;
+                    cond.capacity = length;
+                }
+
+                auto* out = dst;
+
+                for (std::size_t i = 0; i < cond.literals.size(); ++i) {
+                    const auto& l = cond.literals[i];
+                    out = std::copy(std::begin(l), std::end(l), out);
+
+                    if (i < placeholders) {
+                        const auto& v = values_[cond.first_placeholder + i];
+                        *out++ = '\'';
+                        out = std::copy(std::begin(v), std::end(v), out);
+                        *out++ = '\'';
+                    }
+                }
+
+                *out = '\0';
+            }
+        }
+
+        // Names the query in error messages, placeholders included.
+        const std::string query_;
+        genQueryInp_t input_;
+        std::vector<condition> conditions_;
+        std::vector<std::string> values_;
+        std::vector<bool> bound_;
+    };
+} // namespace irods
+
+#endif // IRODS_PREPARED_QUERY_HPP
@@ -12,18 +12,118 @@
 
 #include "irods_log.hpp"
 #include "rcMisc.h"
+#include "cancellation_token.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <future>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 char *getCondFromString( char * t );
 
 namespace irods {
 
+    struct query_options {
+        // When enabled, the next page of results is requested on a background
+        // thread as soon as the current page arrives. Only one request is
+        // outstanding at a time, so the protocol stays in order, but the
+        // connection must not be used for anything else while the query is
+        // alive.
+        bool pipelined = false;
+
+        // The number of rows requested per page.
+        int page_size = MAX_SQL_ROWS;
+
+        // When enabled, the page size doubles while pages are full and arrive
+        // in under half of "target_page_latency", and halves when a page takes
+        // longer than the target or exceeds "max_page_bytes". The page size
+        // always stays within [min_page_size, max_page_size]. The server may
+        // still return fewer rows than requested.
+        bool adaptive_page_size = false;
+        int min_page_size = 32;
+        int max_page_size = 16 * MAX_SQL_ROWS;
+        std::chrono::milliseconds target_page_latency{250};
+        std::size_t max_page_bytes = 8 * 1024 * 1024;
+
+        // Asks the server to report the total number of rows matched by a
+        // general query. See query::total_row_count().
+        bool total_row_count = false;
+
+        // When the token is cancelled, iteration ends at the next row and no
+        // further pages are requested. The server statement is closed as
+        // soon as the query notices, leaving the connection free for reuse.
+        std::optional<cancellation_token> cancellation;
+    };
+
     template <typename connection_type>
     class query {
     public:
         typedef std::vector<std::string> value_type;
 
+        // A non-owning view of a single row in the current page of results.
+        // The views returned by operator[] point directly into the page
+        // buffers and are only valid until the iterator moves to the next
+        // page. Use the explicit conversion to value_type to keep a row.
+        class row_view {
+            public:
+            row_view(const genQueryOut_t* _output, int _row_idx) noexcept :
+                output_{_output},
+                row_idx_{_row_idx} {
+            }
+
+            std::size_t size() const noexcept {
+                return output_->attriCnt;
+            }
+
+            std::string_view operator[](std::size_t _attr_idx) const noexcept {
+                const auto& result = output_->sqlResult[_attr_idx];
+                return &result.value[result.len * row_idx_];
+            }
+
+            explicit operator value_type() const {
+                value_type res;
+                res.reserve(size());
+                for(std::size_t attr_idx = 0; attr_idx < size(); ++attr_idx) {
+                    res.emplace_back((*this)[attr_idx]);
+                }
+                return res;
+            }
+
+            private:
+            const genQueryOut_t* output_;
+            int row_idx_;
+        }; // class row_view
+
+        // A non-owning view of the rows in one page of results. Like a
+        // row_view, it is only valid until the next page is fetched.
+        class page_view {
+            public:
+            page_view(const genQueryOut_t* _output, int _row_cnt) noexcept :
+                output_{_output},
+                row_cnt_{_row_cnt} {
+            }
+
+            std::size_t size() const noexcept {
+                return row_cnt_;
+            }
+
+            std::size_t column_count() const noexcept {
+                return output_->attriCnt;
+            }
+
+            row_view operator[](std::size_t _row_idx) const noexcept {
+                return row_view{output_, static_cast<int>(_row_idx)};
+            }
+
+            private:
+            const genQueryOut_t* output_;
+            int row_cnt_;
+        }; // class page_view
+
         enum query_type {
             GENERAL = 0,
             SPECIFIC = 1
@@ -77,7 +177,7 @@ namespace irods {
                 return gen_output_->rowCnt;
             }
 
-            std::string query_string() {
+            const std::string& query_string() const {
                 return query_string_;
             }
 
@@ -94,14 +194,8 @@ namespace irods {
                 return cont_idx() <= 0;
             }
 
-            value_type capture_results(int _row_idx) {
-                value_type res;
-                for(int attr_idx = 0; attr_idx < gen_output_->attriCnt; ++attr_idx) {
-                    uint32_t offset = gen_output_->sqlResult[attr_idx].len * _row_idx;
-                    std::string str{&gen_output_->sqlResult[attr_idx].value[offset]};
-                    res.push_back(str);
-                }
-                return res;
+            row_view capture_results(int _row_idx) {
+                return row_view{gen_output_, _row_idx};
             }
 
             bool results_valid() {
@@ -113,32 +207,221 @@ namespace irods {
                 }
             }
 
-            virtual int fetch_page() = 0;
-            virtual void reset_for_page_boundary() = 0;
+            int fetch_page() {
+                return timed_fetch_page_into(&gen_output_);
+            }
+
+            // Invokes "_func" with each remaining page, starting with the
+            // current one. The final page is truncated to the query limit.
+            // If "_func" returns a bool, returning false stops the iteration
+            // and closes the query.
+            template <typename Function>
+            void for_each_page(Function& _func) {
+                uint32_t total_rows = 0;
+
+                while(results_valid()) {
+                    int rows = row_cnt();
+                    if(query_limit_ && total_rows + rows > query_limit_) {
+                        rows = query_limit_ - total_rows;
+                    }
+
+                    total_rows += rows;
+
+                    if constexpr(std::is_same_v<std::invoke_result_t<Function&, page_view>, bool>) {
+                        if(!_func(page_view{gen_output_, rows})) {
+                            close();
+                            return;
+                        }
+                    }
+                    else {
+                        _func(page_view{gen_output_, rows});
+                    }
+
+                    if(query_limit_exceeded(total_rows) || query_complete()) {
+                        return;
+                    }
+
+                    if(cancelled()) {
+                        close();
+                        return;
+                    }
+
+                    const int err = advance_page();
+                    if(err < 0) {
+                        if(CAT_NO_ROWS_FOUND != err) {
+                            THROW(
+                                err,
+                                boost::format("query failed for [%s]") %
+                                query_string_);
+                        }
+                        return;
+                    }
+                }
+            } // for_each_page
+
+            int total_row_count() {
+                return gen_output_ ? gen_output_->totalRowCount : 0;
+            }
+
+            bool cancelled() const {
+                return options_.cancellation && options_.cancellation->cancelled();
+            }
+
+            bool closed() const {
+                return closed_;
+            }
+
+            // Ends the query early. Waits for an outstanding prefetch, then
+            // closes the server statement if more pages remain. Only the first
+            // call has any effect.
+            void close() {
+                if(closed_) {
+                    return;
+                }
+
+                closed_ = true;
+                finish_prefetch();
+                close_statement();
+            }
+
+            void reset_for_page_boundary() {
+                if(gen_output_) {
+                    set_continue_index(gen_output_->continueInx);
+                    freeGenQueryOut(&gen_output_);
+                }
+            }
+
+            // Replaces the current page with the next one. In pipelined mode
+            // the next page has usually been requested already, so this only
+            // waits for it to arrive.
+            int advance_page() {
+                if(!prefetch_.valid()) {
+                    reset_for_page_boundary();
+                    return fetch_page();
+                }
+
+                const int err = finish_prefetch();
+                if(err >= 0) {
+                    start_prefetch();
+                }
+
+                return err;
+            }
+
+            // Requests the page following the current one on a background
+            // thread. Does nothing unless pipelining is enabled.
+            void start_prefetch() {
+                if(!options_.pipelined || !gen_output_ || query_complete()) {
+                    return;
+                }
+
+                set_continue_index(gen_output_->continueInx);
+                prefetch_ = std::async(std::launch::async, [this] {
+                    return timed_fetch_page_into(&next_output_);
+                });
+            }
+
+            // Waits for an outstanding prefetch and makes its page the
+            // current one. Must be called before any other request is sent
+            // on the connection.
+            int finish_prefetch() {
+                if(!prefetch_.valid()) {
+                    return 0;
+                }
+
+                const int err = prefetch_.get();
+                freeGenQueryOut(&gen_output_);
+                gen_output_ = next_output_;
+                next_output_ = nullptr;
+                return err;
+            }
+
+            // Fetches a page and, in adaptive mode, sizes the next page based
+            // on how long this one took.
+            int timed_fetch_page_into(genQueryOut_t** _output) {
+                const auto start = std::chrono::steady_clock::now();
+                const int err = fetch_page_into(_output);
+
+                if(err >= 0) {
+                    adjust_page_size(std::chrono::steady_clock::now() - start, *_output);
+                }
+
+                return err;
+            }
+
+            void adjust_page_size(
+                std::chrono::steady_clock::duration _latency,
+                const genQueryOut_t*                _output) {
+                if(!options_.adaptive_page_size || !_output) {
+                    return;
+                }
+
+                std::size_t row_bytes = 0;
+                for(int attr_idx = 0; attr_idx < _output->attriCnt; ++attr_idx) {
+                    row_bytes += _output->sqlResult[attr_idx].len;
+                }
+
+                const auto page_bytes = row_bytes * _output->rowCnt;
+
+                if(_latency > options_.target_page_latency || page_bytes > options_.max_page_bytes) {
+                    page_size_ = std::max(options_.min_page_size, page_size_ / 2);
+                }
+                else if(_latency < options_.target_page_latency / 2 && _output->rowCnt >= page_size_) {
+                    page_size_ = std::min(options_.max_page_size, page_size_ * 2);
+                }
+
+                set_max_rows(page_size_);
+            }
+
+            virtual int fetch_page_into(genQueryOut_t** _output) = 0;
+            virtual void set_continue_index(int _continue_idx) = 0;
+            virtual void set_max_rows(int _max_rows) = 0;
+
+            // Releases the current page and, if the server has more rows
+            // pending, tells it to discard them.
+            virtual void close_statement() = 0;
             virtual ~query_impl_base() {
+                freeGenQueryOut(&next_output_);
             }
 
             query_impl_base(
                 connection_type* _comm,
                 const uint32_t           _query_limit,
-                const std::string&       _q) :
+                const std::string&       _q,
+                const query_options&     _options) :
                 comm_{_comm},
                 query_limit_{_query_limit},
                 query_string_{_q},
-                gen_output_{} {
+                options_{_options},
+                page_size_{_options.page_size > 0 ? _options.page_size : MAX_SQL_ROWS},
+                gen_output_{},
+                next_output_{},
+                prefetch_{},
+                closed_{} {
             };
             protected:
             connection_type* comm_;
             const uint32_t query_limit_;
             const std::string query_string_;
+            const query_options options_;
+            int page_size_;
             genQueryOut_t* gen_output_;
+            genQueryOut_t* next_output_;
+            std::future<int> prefetch_;
+            bool closed_;
         }; // class query_impl_base
 
         class gen_query_impl : public query_impl_base {
             public:
             virtual ~gen_query_impl() {
+                this->close();
+                if(owns_input_) {
+                    clearGenQueryInp(&gen_input_);
+                }
+            }
+
+            void close_statement() override {
                 if(this->gen_output_ && this->gen_output_->continueInx) {
-                    rodsLog(LOG_NOTICE, "[%s] - continueInx is not 0", __FUNCTION__);
                     // Close statements for this query
                     gen_input_.continueInx = this->gen_output_->continueInx;
                     freeGenQueryOut(&this->gen_output_);
@@ -154,31 +437,37 @@ namespace irods {
                     }
                 }
                 freeGenQueryOut(&this->gen_output_);
-                clearGenQueryInp(&gen_input_);
             }
 
-            void reset_for_page_boundary() override {
-                if(this->gen_output_) {
-                    gen_input_.continueInx = this->gen_output_->continueInx;
-                    freeGenQueryOut(&this->gen_output_);
-                }
+            void set_continue_index(int _continue_idx) override {
+                gen_input_.continueInx = _continue_idx;
             }
 
-            int fetch_page() override {
+            void set_max_rows(int _max_rows) override {
+                gen_input_.maxRows = _max_rows;
+            }
+
+            int fetch_page_into(genQueryOut_t** _output) override {
                 return gen_query_fcn(
                            this->comm_,
                            &gen_input_,
-                           &this->gen_output_);
-            } // fetch_page
+                           _output);
+            } // fetch_page_into
 
             gen_query_impl(
                 connection_type* _comm,
                 int                      _query_limit,
-                const std::string&       _query_string) :
-                query_impl_base(_comm, _query_limit, _query_string) {
-
-                memset(&gen_input_, 0, sizeof(gen_input_));
-                gen_input_.maxRows = MAX_SQL_ROWS;
+                const std::string&       _query_string,
+                const query_options&     _options) :
+                query_impl_base(_comm, _query_limit, _query_string, _options),
+                owned_input_{},
+                gen_input_{owned_input_},
+                owns_input_{true} {
+
+                gen_input_.maxRows = this->page_size_;
+                if(_options.total_row_count) {
+                    gen_input_.options |= RETURN_TOTAL_ROW_COUNT;
+                }
                 const int fill_err = fillGenQueryInpFromStrCond(
                                          const_cast<char*>(_query_string.c_str()),
                                          &gen_input_);
@@ -190,8 +479,39 @@ namespace irods {
                 }
             } // ctor
 
+            // Runs a query from an input that has already been filled in,
+            // e.g. by a prepared_query. The input is borrowed, not copied,
+            // and must outlive the query. "_description" names the query in
+            // error messages; if it is empty, one is built from the input.
+            gen_query_impl(
+                connection_type* _comm,
+                int                      _query_limit,
+                genQueryInp_t&           _input,
+                const std::string&       _description,
+                const query_options&     _options) :
+                query_impl_base(
+                    _comm,
+                    _query_limit,
+                    _description.empty() ? describe(_input) : _description,
+                    _options),
+                owned_input_{},
+                gen_input_{_input},
+                owns_input_{false} {
+
+                gen_input_.continueInx = 0;
+                gen_input_.maxRows = this->page_size_;
+                if(_options.total_row_count) {
+                    gen_input_.options |= RETURN_TOTAL_ROW_COUNT;
+                }
+                else {
+                    gen_input_.options &= ~RETURN_TOTAL_ROW_COUNT;
+                }
+            } // ctor
+
             private:
-            genQueryInp_t gen_input_; 
+            genQueryInp_t owned_input_;
+            genQueryInp_t& gen_input_;
+            const bool owns_input_;
 #ifdef RODS_SERVER
             const std::function<
                 int(connection_type*,
@@ -211,6 +531,10 @@ namespace irods {
         class spec_query_impl : public query_impl_base {
             public:
             virtual ~spec_query_impl() {
+                this->close();
+            }
+
+            void close_statement() override {
                 if(this->gen_output_ && this->gen_output_->continueInx) {
                     // Close statement for this query
                     spec_input_.continueInx = this->gen_output_->continueInx;
@@ -230,28 +554,30 @@ namespace irods {
                 freeGenQueryOut(&this->gen_output_);
             }
 
-            void reset_for_page_boundary() override {
-                if(this->gen_output_) {
-                    spec_input_.continueInx = this->gen_output_->continueInx;
-                    freeGenQueryOut(&this->gen_output_);
-                }
+            void set_continue_index(int _continue_idx) override {
+                spec_input_.continueInx = _continue_idx;
             }
 
-            int fetch_page() override {
+            void set_max_rows(int _max_rows) override {
+                spec_input_.maxRows = _max_rows;
+            }
+
+            int fetch_page_into(genQueryOut_t** _output) override {
                 return spec_query_fcn(
                            this->comm_,
                            &spec_input_,
-                           &this->gen_output_);
-            } // fetch_page
+                           _output);
+            } // fetch_page_into
 
             spec_query_impl(
                 connection_type* _comm,
                 int                      _query_limit,
-                const std::string&       _query_string) :
-                query_impl_base(_comm, _query_limit, _query_string) {
+                const std::string&       _query_string,
+                const query_options&     _options) :
+                query_impl_base(_comm, _query_limit, _query_string, _options) {
 
                 memset(&spec_input_, 0, sizeof(spec_input_));
-                spec_input_.maxRows = MAX_SQL_ROWS;
+                spec_input_.maxRows = this->page_size_;
                 spec_input_.sql = const_cast<char*>(_query_string.c_str());
 
                 int spec_err = spec_query_fcn(
@@ -293,10 +619,10 @@ namespace irods {
             std::shared_ptr<query_impl_base> query_impl_;
 
             public:
-            using value_type        = value_type;
-            using pointer           = const value_type*;
-            using reference         = value_type;
-            using difference_type   = value_type;
+            using value_type        = row_view;
+            using pointer           = const row_view*;
+            using reference         = row_view;
+            using difference_type   = std::ptrdiff_t;
             using iterator_category = std::forward_iterator_tag;
 
             explicit iterator() :
@@ -352,7 +678,7 @@ namespace irods {
                 return val;
             }
 
-            value_type operator*() {
+            row_view operator*() {
                 return capture_results();
             }
 
@@ -361,6 +687,11 @@ namespace irods {
                 query_impl_->reset_for_page_boundary();
             }
 
+            int advance_page() {
+                row_idx_ = 0;
+                return query_impl_->advance_page();
+            }
+
             void advance_query() {
                 total_rows_processed_++;
                 if(query_impl_->query_limit_exceeded(total_rows_processed_)) {
@@ -368,6 +699,12 @@ namespace irods {
                     return;
                 }
 
+                if(query_impl_->closed() || query_impl_->cancelled()) {
+                    query_impl_->close();
+                    end_iteration_state_ = true;
+                    return;
+                }
+
                 row_idx_++;
                 if(query_impl_->page_in_flight(row_idx_)) {
                     return;
@@ -378,8 +715,7 @@ namespace irods {
                     return;
                 }
 
-                reset_for_page_boundary();
-                const int query_err = query_impl_->fetch_page();
+                const int query_err = advance_page();
                 if(query_err < 0) {
                     if(CAT_NO_ROWS_FOUND != query_err) {
                         THROW(
@@ -395,7 +731,7 @@ namespace irods {
 
             } // advance_query 
 
-            value_type capture_results() {
+            row_view capture_results() {
                 return query_impl_->capture_results(row_idx_);
             }
         }; // class iterator
@@ -404,42 +740,68 @@ namespace irods {
             connection_type* _comm,
             const std::string&       _query_string,
             uintmax_t                _query_limit = 0,
-            query_type               _query_type = GENERAL) {
+            query_type               _query_type = GENERAL,
+            const query_options&     _options = {}) {
                 if(_query_type == GENERAL) {
                     query_impl_ = std::make_shared<gen_query_impl>(
                                       _comm,
                                       _query_limit,
-                                      _query_string);
+                                      _query_string,
+                                      _options);
                 }
                 else if(_query_type == SPECIFIC) {
                     query_impl_ = std::make_shared<spec_query_impl>(
                                       _comm,
                                       _query_limit,
-                                      _query_string);
+                                      _query_string,
+                                      _options);
                 }
 
-                const int fetch_err = query_impl_->fetch_page(); 
-                if(fetch_err < 0) {
-                    if(CAT_NO_ROWS_FOUND == fetch_err) {
-                        iter_ = std::make_unique<iterator>();
-                    }
-                    else {
-                        THROW(
-                            fetch_err,
-                            boost::format("query failed for [%s] type [%d]") %
-                            _query_string %
-                            _query_type);
-                    }
-                }
+                fetch_first_page(_query_type);
+        } // ctor
 
-                if(query_impl_->results_valid()) {
-                    iter_ = std::make_unique<iterator>(query_impl_);
-                }
-                else {
-                    iter_ = std::make_unique<iterator>();
-                }
+        // Runs a general query from an input that has already been filled
+        // in. No query string is parsed. The input is borrowed and must
+        // outlive the query. Callers that run the same input repeatedly
+        // should pass "_description" so that describe() is not called for
+        // every query.
+        explicit query(
+            connection_type* _comm,
+            genQueryInp_t&           _input,
+            uintmax_t                _query_limit = 0,
+            const query_options&     _options = {},
+            const std::string&       _description = {}) {
+                query_impl_ = std::make_shared<gen_query_impl>(
+                                  _comm,
+                                  _query_limit,
+                                  _input,
+                                  _description,
+                                  _options);
+
+                fetch_first_page(GENERAL);
         } // ctor
 
+        // Produces a human-readable query string from a general query input.
+        // Used for error messages and as a stable description of the query.
+        static std::string describe(const genQueryInp_t& _input) {
+            std::string str{"select "};
+            for(int i = 0; i < _input.selectInp.len; ++i) {
+                if(i > 0) {
+                    str += ", ";
+                }
+                const char* name = getAttrNameFromAttrId(_input.selectInp.inx[i]);
+                str += name ? name : std::to_string(_input.selectInp.inx[i]);
+            }
+            for(int i = 0; i < _input.sqlCondInp.len; ++i) {
+                str += (i > 0) ? " and " : " where ";
+                const char* name = getAttrNameFromAttrId(_input.sqlCondInp.inx[i]);
+                str += name ? name : std::to_string(_input.sqlCondInp.inx[i]);
+                str += ' ';
+                str += _input.sqlCondInp.value[i];
+            }
+            return str;
+        } // describe
+
         ~query() {
         }
 
@@ -450,13 +812,68 @@ namespace irods {
             return iterator();
         }
         value_type front() {
-            return (*(*iter_));
+            return value_type(*(*iter_));
         }
 
         size_t size()  {
             return query_impl_->size();
         }
+
+        // Invokes "_func" with a page_view for each page of results. This is
+        // an alternative to iterating row by row and must not be mixed with
+        // it on the same query. If "_func" returns a bool, returning false
+        // stops fetching pages.
+        template <typename Function>
+        void for_each_page(Function&& _func) {
+            query_impl_->for_each_page(_func);
+        }
+
+        // Stops the query before all rows have been read. The server
+        // statement is closed immediately rather than when the query is
+        // destroyed, so the connection can be returned to a pool or reused
+        // right away. Iterators obtained earlier end on their next increment
+        // and must not be dereferenced.
+        void close() {
+            query_impl_->close();
+            iter_ = std::make_unique<iterator>();
+        }
+
+        // The total number of rows matched by the query, as reported by the
+        // server. Only available for general queries constructed with
+        // query_options::total_row_count enabled.
+        size_t total_row_count() {
+            return query_impl_->total_row_count();
+        }
     private:
+        void fetch_first_page(query_type _query_type) {
+            if(query_impl_->cancelled()) {
+                iter_ = std::make_unique<iterator>();
+                return;
+            }
+
+            const int fetch_err = query_impl_->fetch_page();
+            if(fetch_err < 0) {
+                if(CAT_NO_ROWS_FOUND == fetch_err) {
+                    iter_ = std::make_unique<iterator>();
+                }
+                else {
+                    THROW(
+                        fetch_err,
+                        boost::format("query failed for [%s] type [%d]") %
+                        query_impl_->query_string() %
+                        _query_type);
+                }
+            }
+
+            if(query_impl_->results_valid()) {
+                iter_ = std::make_unique<iterator>(query_impl_);
+                query_impl_->start_prefetch();
+            }
+            else {
+                iter_ = std::make_unique<iterator>();
+            }
+        } // fetch_first_page
+
         std::unique_ptr<iterator>        iter_;
         std::shared_ptr<query_impl_base> query_impl_;
     }; // class query
@@ -0,0 +1,377 @@
+#ifndef IRODS_QUERY_CACHE_HPP
+#define IRODS_QUERY_CACHE_HPP
+
+#include "query.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace irods
+{
+    struct query_cache_options
+    {
+        // How long an entry is served when no TTL is given on insertion.
+        std::chrono::steady_clock::duration default_ttl = std::chrono::seconds{30};
+
+        // The approximate number of bytes the cached results may occupy.
+        // Least recently used entries are evicted to stay within it.
+        std::size_t memory_budget = 16 * 1024 * 1024;
+    };
+
+    struct query_cache_metrics
+    {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t expirations;
+        std::uint64_t evictions;
+        std::uint64_t invalidations;
+        std::size_t entries;
+        std::size_t memory_used;
+    };
+
+    // A thread-safe cache of general query results. Nothing is cached unless
+    // a query is run through a query_cache explicitly.
+    //
+    //     irods::query_cache cache;
+    //
+    //     for (auto&& row : *cache.execute(&comm, "select ZONE_NAME where ZONE_TYPE = 'local'")) {
+    //         // ...
+    //     }
+    //
+    // Entries are keyed by the client user, the zone and the query string
+    // with insignificant whitespace removed. The user is part of the key
+    // because the catalog filters results by permission.
+    //
+    // Every live cache is notified by invalidate_all(), which the filesystem
+    // library calls after operations that modify the catalog. It drops every
+    // entry, because a query may depend on a path without containing it.
+    //
+    // A query that is running when its zone is invalidated does not cache its
+    // results, so results read before a change are never stored after it.
+    class query_cache
+    {
+    public:
+        using clock_type = std::chrono::steady_clock;
+        using value_type = std::vector<std::vector<std::string>>;
+
+        explicit query_cache(const query_cache_options& _options = {})
+            : options_{_options}
+            , mutex_{}
+            , lru_{}
+            , entries_{}
+            , memory_used_{}
+            , global_generation_{}
+            , generations_{}
+            , hits_{}
+            , misses_{}
+            , expirations_{}
+            , evictions_{}
+            , invalidations_{}
+        {
+            std::lock_guard lk{registry_mutex()};
+            registry().push_back(this);
+            ++registry_size_;
+        }
+
+        query_cache(const query_cache&) = delete;
+        query_cache& operator=(const query_cache&) = delete;
+
+        ~query_cache()
+        {
+            std::lock_guard lk{registry_mutex()};
+            auto& r = registry();
+            r.erase(std::remove(std::begin(r), std::end(r), this), std::end(r));
+            --registry_size_;
+        }
+
+        // Returns the cached results of "_query", running it on "_comm" if
+        // they are missing or expired.
+        template <typename connection_type>
+        std::shared_ptr<const value_type> execute(connection_type* _comm, const std::string& _query)
+        {
+            return execute(_comm, _query, options_.default_ttl);
+        }
+
+        template <typename connection_type>
+        std::shared_ptr<const value_type> execute(connection_type* _comm,
+                                                  const std::string& _query,
+                                                  clock_type::duration _ttl)
+        {
+            auto key = make_key(_comm->clientUser.userName, _comm->clientUser.rodsZone, _query);
+
+            if (auto rows = find(key); rows) {
+                return rows;
+            }
+
+            const auto gen = generation(_comm->clientUser.rodsZone);
+
+            // The query runs without holding the lock. Concurrent misses on
+            // the same key may each run it, and the last result wins.
+            value_type rows;
+
+            for (auto&& row : query<connection_type>{_comm, _query}) {
+                rows.push_back(static_cast<std::vector<std::string>>(row));
+            }
+
+            auto result = std::make_shared<const value_type>(std::move(rows));
+            insert(std::move(key), _comm->clientUser.rodsZone, result, _ttl, gen);
+
+            return result;
+        }
+
+        // Removes every entry of "_zone" whose query contains "_text". An
+        // empty zone or text matches every entry.
+        //
+        // "_text" is matched against the query string only. Queries that
+        // depend on the same data through other columns (e.g. DATA_ID) or
+        // patterns are not matched, so pass an empty text when in doubt.
+        void invalidate(std::string_view _zone, std::string_view _text = {})
+        {
+            std::lock_guard lk{mutex_};
+
+            // Queries of the zone that are running now must not store results
+            // read before this call.
+            if (_zone.empty()) {
+                ++global_generation_;
+            }
+            else {
+                ++generations_[std::string{_zone}];
+            }
+
+            for (auto it = std::begin(lru_); it != std::end(lru_);) {
+                const bool zone_matches = _zone.empty() || it->zone == _zone;
+                const bool text_matches = _text.empty() || it->key.find(_text) != std::string::npos;
+
+                if (zone_matches && text_matches) {
+                    it = erase(it);
+                    ++invalidations_;
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+        void clear()
+        {
+            std::lock_guard lk{mutex_};
+            ++global_generation_;
+            invalidations_ += lru_.size();
+            entries_.clear();
+            lru_.clear();
+            memory_used_ = 0;
+        }
+
+        query_cache_metrics metrics() const
+        {
+            std::lock_guard lk{mutex_};
+            return {hits_, misses_, expirations_, evictions_, invalidations_, lru_.size(), memory_used_};
+        }
+
+        // Invalidates matching entries in every live cache. Cheap when no
+        // cache exists.
+        static void invalidate_all(std::string_view _zone, std::string_view _text = {})
+        {
+            if (registry_size_.load(std::memory_order_relaxed) == 0) {
+                return;
+            }
+
+            std::lock_guard lk{registry_mutex()};
+
+            for (auto* cache : registry()) {
+                cache->invalidate(_zone, _text);
+            }
+        }
+
+        // Collapses runs of whitespace outside of quotes into a single space
+        // and trims both ends, so trivially different spellings of a query
+        // share an entry.
+        static std::string normalize(std::string_view _query)
+        {
+            std::string s;
+            s.reserve(_query.size());
+
+            bool in_quotes = false;
+            bool pending_space = false;
+
+            for (auto c : _query) {
+                if (!in_quotes && std::isspace(static_cast<unsigned char>(c))) {
+                    pending_space = !s.empty();
+                    continue;
+                }
+
+                if (pending_space) {
+                    s += ' ';
+                    pending_space = false;
+                }
+
+                if (c == '\'') {
+                    in_quotes = !in_quotes;
+                }
+
+                s += c;
+            }
+
+            return s;
+        }
+
+    private:
+        struct entry
+        {
+            std::string key;
+            std::string zone;
+            std::shared_ptr<const value_type> rows;
+            clock_type::time_point expires;
+            std::size_t size;
+        };
+
+        using lru_list = std::list<entry>;
+
+        static std::string make_key(std::string_view _user, std::string_view _zone, std::string_view _query)
+        {
+            std::string key{_user};
+            key += '#';
+            key += _zone;
+            key += '\n';
+            key += normalize(_query);
+            return key;
+        }
+
+        static std::size_t estimate_size(const std::string& _key, const value_type& _rows)
+        {
+            std::size_t size = sizeof(entry) + 2 * _key.size();
+
+            for (const auto& row : _rows) {
+                size += sizeof(row);
+
+                for (const auto& value : row) {
+                    size += sizeof(value) + value.capacity();
+                }
+            }
+
+            return size;
+        }
+
+        std::shared_ptr<const value_type> find(const std::string& _key)
+        {
+            std::lock_guard lk{mutex_};
+
+            const auto it = entries_.find(_key);
+
+            if (it == std::end(entries_)) {
+                ++misses_;
+                return nullptr;
+            }
+
+            if (it->second->expires <= clock_type::now()) {
+                erase(it->second);
+                ++expirations_;
+                ++misses_;
+                return nullptr;
+            }
+
+            lru_.splice(std::begin(lru_), lru_, it->second);
+            ++hits_;
+
+            return it->second->rows;
+        }
+
+        // Changes whenever entries of "_zone" are invalidated.
+        std::uint64_t generation(const std::string& _zone) const
+        {
+            std::lock_guard lk{mutex_};
+            return generation_locked(_zone);
+        }
+
+        std::uint64_t generation_locked(const std::string& _zone) const
+        {
+            const auto it = generations_.find(_zone);
+            return global_generation_ + (it != std::end(generations_) ? it->second : 0);
+        }
+
+        void insert(std::string&& _key,
+                    const std::string& _zone,
+                    std::shared_ptr<const value_type> _rows,
+                    clock_type::duration _ttl,
+                    std::uint64_t _generation)
+        {
+            const auto size = estimate_size(_key, *_rows);
+
+            // An entry larger than the whole budget would evict everything
+            // and still not fit.
+            if (size > options_.memory_budget) {
+                return;
+            }
+
+            std::lock_guard lk{mutex_};
+
+            // The zone was invalidated while the query was running.
+            if (generation_locked(_zone) != _generation) {
+                return;
+            }
+
+            if (const auto it = entries_.find(_key); it != std::end(entries_)) {
+                erase(it->second);
+            }
+
+            while (!lru_.empty() && memory_used_ + size > options_.memory_budget) {
+                erase(std::prev(std::end(lru_)));
+                ++evictions_;
+            }
+
+            lru_.push_front({std::move(_key), std::string{_zone}, std::move(_rows), clock_type::now() + _ttl, size});
+            entries_.emplace(lru_.front().key, std::begin(lru_));
+            memory_used_ += size;
+        }
+
+        lru_list::iterator erase(lru_list::iterator _it)
+        {
+            memory_used_ -= _it->size;
+            entries_.erase(_it->key);
+            return lru_.erase(_it);
+        }
+
+        static std::vector<query_cache*>& registry()
+        {
+            static std::vector<query_cache*> caches;
+            return caches;
+        }
+
+        static std::mutex& registry_mutex()
+        {
+            static std::mutex m;
+            return m;
+        }
+
+        static inline std::atomic<int> registry_size_{0};
+
+        const query_cache_options options_;
+
+        mutable std::mutex mutex_;
+        lru_list lru_;
+        std::unordered_map<std::string_view, lru_list::iterator> entries_;
+        std::size_t memory_used_;
+
+        std::uint64_t global_generation_;
+        std::unordered_map<std::string, std::uint64_t> generations_;
+
+        std::uint64_t hits_;
+        std::uint64_t misses_;
+        std::uint64_t expirations_;
+        std::uint64_t evictions_;
+        std::uint64_t invalidations_;
+    }; // class query_cache
+} // namespace irods
+
+#endif // IRODS_QUERY_CACHE_HPP
@@ -3,40 +3,131 @@
 
 #include "thread_pool.hpp"
 #include "query.hpp"
+#include "cancellation_token.hpp"
 #include "irods_exception.hpp"
+#include "irods_at_scope_exit.hpp"
+#include "rcMisc.h"
 
 #include <string>
+#include <string_view>
 #include <functional>
 #include <future>
 #include <vector>
+#include <deque>
 #include <tuple>
 #include <exception>
+#include <optional>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
 
 namespace irods
 {
+    // How a query is split in partitioned mode.
+    enum class partition_method
+    {
+        data_id,   // Contiguous DATA_ID ranges.
+        coll_id,   // Contiguous COLL_ID ranges.
+        row_offset // Windows of rows. The query must order its results.
+    };
+
+    struct partition_options
+    {
+        partition_method method = partition_method::data_id;
+
+        // The number of partitions. Each one is fetched on its own pooled
+        // connection.
+        int partitions = 4;
+
+        // The number of threads running the job.
+        int workers = 4;
+
+        // The number of fetched pages that may wait for a worker before the
+        // fetching threads block.
+        std::size_t max_queued_pages = 16;
+    };
+
     template <typename ConnectionType>
     class query_processor
     {
     public:
         // clang-format off
-        using error      = std::tuple<int, std::string>;
-        using errors     = std::vector<error>;
-        using result_row = typename query<ConnectionType>::value_type;
-        using job        = std::function<void (const result_row&)>;
-        using query_type = typename query<ConnectionType>::query_type;
+        using error       = std::tuple<int, std::string>;
+        using errors      = std::vector<error>;
+        using result_row  = typename query<ConnectionType>::value_type;
+        using page_view   = typename query<ConnectionType>::page_view;
+        using job         = std::function<void (const result_row&)>;
+        using batch_job   = std::function<void (const page_view&)>;
+        using error_sink  = std::function<void (const error&)>;
+        using query_type  = typename query<ConnectionType>::query_type;
         // clang-format on
 
-        query_processor(const std::string& _query, job _job, uint32_t _limit = 0, query_type _type = query_type::GENERAL)
+        query_processor(const std::string& _query,
+                        job _job,
+                        uint32_t _limit = 0,
+                        query_type _type = query_type::GENERAL,
+                        const query_options& _options = {})
             : query_{_query}
             , job_{_job}
+            , batch_job_{}
+            , limit_{_limit}
+            , type_{_type}
+            , options_{_options}
+            , error_sink_{}
+            , error_sink_mutex_{}
+        {
+        }
+
+        // Runs "_job" once per page of results instead of once per row. An
+        // error thrown by the job is reported once for the whole page. The
+        // page view is only valid for the duration of the call.
+        //
+        // Callables that also accept a single row (e.g. generic lambdas) are
+        // treated as per-row jobs.
+        template <typename Function,
+                  typename = std::enable_if_t<!std::is_invocable_v<Function&, const result_row&> &&
+                                              std::is_invocable_v<Function&, const page_view&>>>
+        query_processor(const std::string& _query,
+                        Function _job,
+                        uint32_t _limit = 0,
+                        query_type _type = query_type::GENERAL,
+                        const query_options& _options = {})
+            : query_{_query}
+            , job_{}
+            , batch_job_{std::move(_job)}
             , limit_{_limit}
             , type_{_type}
+            , options_{_options}
+            , error_sink_{}
+            , error_sink_mutex_{}
         {
         }
 
         query_processor(const query_processor&) = delete;
         query_processor& operator=(const query_processor&) = delete;
 
+        // Passes errors to "_sink" as they occur instead of collecting them
+        // into the returned errors, so long scans do not hold every error in
+        // memory. Calls to the sink are serialized. Exceptions thrown by the
+        // sink are ignored.
+        query_processor& set_error_sink(error_sink _sink)
+        {
+            error_sink_ = std::move(_sink);
+            return *this;
+        }
+
+        // Stops processing once "_token" is cancelled. No further pages are
+        // fetched, no further rows are passed to the job, and every open
+        // query closes its server statement right away. This is the same as
+        // setting query_options::cancellation.
+        query_processor& set_cancellation_token(const cancellation_token& _token)
+        {
+            options_.cancellation = _token;
+            return *this;
+        }
+
         std::future<errors> execute(thread_pool& _thread_pool, ConnectionType& _conn)
         {
             std::promise<errors> p;
@@ -47,20 +138,55 @@ namespace irods
                 errors errs;
 
                 try {
-                    for (auto&& row : query<ConnectionType>{&conn, query_, limit_, type_}) {
-                        try {
-                            job_(row);
-                        }
-                        catch (const irods::exception& e) {
-                            errs.emplace_back(e.code(), e.what());
-                        }
-                        catch (const std::exception& e) {
-                            errs.emplace_back(SYS_UNKNOWN_ERROR, e.what());
+                    query<ConnectionType> q{&conn, query_, limit_, type_, options_};
+
+                    q.for_each_page([this, &errs](const auto& _page) {
+                        if (cancelled()) {
+                            return false;
                         }
-                    }
+
+                        process_page(_page, errs);
+
+                        return !cancelled();
+                    });
                 }
                 catch (...) {
-                    errs.emplace_back(SYS_UNKNOWN_ERROR, "Unknown error occurred while processing job.");
+                    report(errs, {SYS_UNKNOWN_ERROR, "Unknown error occurred while processing job."});
+                }
+
+                p.set_value(std::move(errs));
+            });
+
+            return future;
+        }
+
+        // Runs the query in partitions. Each partition is fetched on a
+        // connection from "_conn_pool", and the fetched pages are handed to
+        // worker threads that run the job. Errors from every partition and
+        // worker are merged into the result.
+        //
+        // The query must be a general query. The row limit is not applied in
+        // partitioned mode.
+        template <typename ConnectionPool>
+        std::future<errors> execute(thread_pool& _thread_pool,
+                                    ConnectionPool& _conn_pool,
+                                    const partition_options& _options)
+        {
+            std::promise<errors> p;
+
+            auto future = p.get_future();
+
+            thread_pool::defer(_thread_pool, [this, p = std::move(p), &_conn_pool, _options]() mutable {
+                errors errs;
+
+                try {
+                    errs = execute_partitions(_conn_pool, _options);
+                }
+                catch (const irods::exception& e) {
+                    report(errs, {e.code(), e.what()});
+                }
+                catch (...) {
+                    report(errs, {SYS_UNKNOWN_ERROR, "Unknown error occurred while partitioning query."});
                 }
 
                 p.set_value(std::move(errs));
@@ -70,10 +196,375 @@ namespace irods
         }
 
     private:
+        bool cancelled() const noexcept
+        {
+            return options_.cancellation && options_.cancellation->cancelled();
+        }
+
+        // Sends "_error" to the error sink, or adds it to "_errs" if there
+        // is none.
+        void report(errors& _errs, error&& _error)
+        {
+            if (!error_sink_) {
+                _errs.push_back(std::move(_error));
+                return;
+            }
+
+            std::lock_guard lk{error_sink_mutex_};
+
+            try {
+                error_sink_(_error);
+            }
+            catch (...) {
+            }
+        }
+
+        template <typename Function>
+        void run_job(Function _func, errors& _errs)
+        {
+            try {
+                _func();
+            }
+            catch (const irods::exception& e) {
+                report(_errs, {e.code(), e.what()});
+            }
+            catch (const std::exception& e) {
+                report(_errs, {SYS_UNKNOWN_ERROR, e.what()});
+            }
+            catch (...) {
+                report(_errs, {SYS_UNKNOWN_ERROR, "Unknown error occurred while processing job."});
+            }
+        }
+
+        void process_page(const page_view& _page, errors& _errs)
+        {
+            if (batch_job_) {
+                run_job([this, &_page] { batch_job_(_page); }, _errs);
+                return;
+            }
+
+            for (std::size_t i = 0; i < _page.size(); ++i) {
+                if (cancelled()) {
+                    return;
+                }
+
+                run_job([this, &_page, i] { job_(result_row(_page[i])); }, _errs);
+            }
+        }
+
+        // A copy of a page that outlives the query it was fetched by, so that
+        // it can be handed to another thread. The values are laid out like
+        // the genQueryOut_t they came from, which lets a page_view read them.
+        class owned_page
+        {
+        public:
+            explicit owned_page(const page_view& _page)
+                : output_{}
+                , columns_(_page.column_count())
+            {
+                const auto rows = _page.size();
+
+                output_.rowCnt = static_cast<int>(rows);
+                output_.attriCnt = static_cast<int>(columns_.size());
+
+                for (std::size_t col = 0; col < columns_.size(); ++col) {
+                    std::size_t width = 0;
+
+                    for (std::size_t row = 0; row < rows; ++row) {
+                        width = std::max(width, _page[row][col].size());
+                    }
+
+                    // Every value is stored null-terminated in a slot of the
+                    // same width.
+                    ++width;
+
+                    auto& column = columns_[col];
+                    column.assign(width * rows, '\0');
+
+                    for (std::size_t row = 0; row < rows; ++row) {
+                        const std::string_view value = _page[row][col];
+                        std::copy(std::begin(value), std::end(value), column.data() + width * row);
+                    }
+
+                    output_.sqlResult[col].len = static_cast<int>(width);
+                    output_.sqlResult[col].value = column.data();
+                }
+            }
+
+            // Moving the column buffers keeps their storage, so the pointers
+            // in "output_" remain valid. Copies would share them.
+            owned_page(owned_page&&) = default;
+            owned_page& operator=(owned_page&&) = default;
+
+            owned_page(const owned_page&) = delete;
+            owned_page& operator=(const owned_page&) = delete;
+
+            page_view view() const noexcept
+            {
+                return {&output_, output_.rowCnt};
+            }
+
+        private:
+            genQueryOut_t output_;
+            std::vector<std::vector<char>> columns_;
+        };
+
+        // Hands pages from the fetching threads to the workers. pop() returns
+        // an empty optional once every producer has finished and the queue
+        // has been drained.
+        class page_queue
+        {
+        public:
+            page_queue(std::size_t _capacity, int _producers)
+                : capacity_{std::max<std::size_t>(_capacity, 1)}
+                , producers_{_producers}
+                , pages_{}
+                , mutex_{}
+                , not_empty_{}
+                , not_full_{}
+            {
+            }
+
+            void push(owned_page&& _page)
+            {
+                std::unique_lock lk{mutex_};
+                not_full_.wait(lk, [this] { return pages_.size() < capacity_; });
+                pages_.push_back(std::move(_page));
+                not_empty_.notify_one();
+            }
+
+            std::optional<owned_page> pop()
+            {
+                std::unique_lock lk{mutex_};
+                not_empty_.wait(lk, [this] { return !pages_.empty() || producers_ == 0; });
+
+                if (pages_.empty()) {
+                    return std::nullopt;
+                }
+
+                auto pg = std::move(pages_.front());
+                pages_.pop_front();
+                not_full_.notify_one();
+
+                return pg;
+            }
+
+            void producer_done()
+            {
+                std::lock_guard lk{mutex_};
+
+                if (--producers_ == 0) {
+                    not_empty_.notify_all();
+                }
+            }
+
+        private:
+            const std::size_t capacity_;
+            int producers_;
+            std::deque<owned_page> pages_;
+            std::mutex mutex_;
+            std::condition_variable not_empty_;
+            std::condition_variable not_full_;
+        };
+
+        // Fills "_input" from the query string. The caller must release it
+        // with clearGenQueryInp().
+        void fill_input(genQueryInp_t& _input) const
+        {
+            if (const int ec = fillGenQueryInpFromStrCond(const_cast<char*>(query_.c_str()), &_input); ec < 0) {
+                clearGenQueryInp(&_input);
+                THROW(ec, boost::format("query fill failed for [%s]") % query_);
+            }
+        }
+
+        // Returns the inclusive [min, max] range of "_column_id" over the rows
+        // matched by the query.
+        std::optional<std::tuple<std::int64_t, std::int64_t>> id_range(ConnectionType& _conn, int _column_id) const
+        {
+            genQueryInp_t input{};
+            fill_input(input);
+            irods::at_scope_exit<std::function<void()>> free_input{[&input] { clearGenQueryInp(&input); }};
+
+            clearInxIval(&input.selectInp);
+            addInxIval(&input.selectInp, _column_id, SELECT_MIN);
+            addInxIval(&input.selectInp, _column_id, SELECT_MAX);
+
+            for (auto&& row : query<ConnectionType>{&_conn, input}) {
+                if (row[0].empty() || row[1].empty()) {
+                    break;
+                }
+
+                return std::make_tuple(std::stoll(std::string{row[0]}), std::stoll(std::string{row[1]}));
+            }
+
+            return std::nullopt;
+        }
+
+        std::size_t row_count(ConnectionType& _conn) const
+        {
+            genQueryInp_t input{};
+            fill_input(input);
+            irods::at_scope_exit<std::function<void()>> free_input{[&input] { clearGenQueryInp(&input); }};
+
+            query_options opts;
+            opts.page_size = 1;
+            opts.total_row_count = true;
+
+            return query<ConnectionType>{&_conn, input, 0, opts}.total_row_count();
+        }
+
+        using partition = std::tuple<genQueryInp_t, uintmax_t>;
+
+        // Builds the input and row limit of every partition. The caller must
+        // release the inputs with clearGenQueryInp(), even on failure.
+        template <typename ConnectionPool>
+        void make_partitions(ConnectionPool& _conn_pool,
+                             const partition_options& _options,
+                             std::vector<partition>& _partitions) const
+        {
+            const auto n = std::max(_options.partitions, 1);
+
+            auto conn = _conn_pool.get_connection();
+            ConnectionType& comm = conn;
+
+            if (partition_method::row_offset == _options.method) {
+                const auto total = row_count(comm);
+                const auto window = (total + n - 1) / n;
+
+                for (std::size_t offset = 0; offset < total; offset += window) {
+                    auto& input = std::get<0>(_partitions.emplace_back(genQueryInp_t{}, window));
+                    fill_input(input);
+                    input.rowOffset = static_cast<int>(offset);
+                }
+
+                return;
+            }
+
+            const auto column_id = (partition_method::data_id == _options.method) ? COL_D_DATA_ID : COL_COLL_ID;
+            const auto range = id_range(comm, column_id);
+
+            if (!range) {
+                return;
+            }
+
+            const auto [min_id, max_id] = *range;
+            const auto span = (max_id - min_id) / n + 1;
+
+            for (auto lo = min_id; lo <= max_id; lo += span) {
+                const auto hi = std::min(max_id, lo + span - 1);
+
+                auto& input = std::get<0>(_partitions.emplace_back(genQueryInp_t{}, 0));
+                fill_input(input);
+
+                const auto cond = "between '" + std::to_string(lo) + "' '" + std::to_string(hi) + "'";
+                addInxVal(&input.sqlCondInp, column_id, cond.c_str());
+            }
+        }
+
+        template <typename ConnectionPool>
+        errors execute_partitions(ConnectionPool& _conn_pool, const partition_options& _options)
+        {
+            if (type_ != query_type::GENERAL) {
+                THROW(SYS_INVALID_INPUT_PARAM, "only general queries can be partitioned");
+            }
+
+            std::vector<partition> partitions;
+
+            irods::at_scope_exit<std::function<void()>> free_partitions{[&partitions] {
+                for (auto& p : partitions) {
+                    clearGenQueryInp(&std::get<0>(p));
+                }
+            }};
+
+            make_partitions(_conn_pool, _options, partitions);
+
+            if (partitions.empty()) {
+                return {};
+            }
+
+            errors errs;
+            std::mutex errs_mutex;
+
+            const auto merge = [&errs, &errs_mutex](errors& _errs) {
+                std::lock_guard lk{errs_mutex};
+                std::move(std::begin(_errs), std::end(_errs), std::back_inserter(errs));
+            };
+
+            page_queue queue{_options.max_queued_pages, static_cast<int>(partitions.size())};
+
+            // Fetchers block while the queue is full, so they get threads of
+            // their own rather than competing with the workers.
+            thread_pool threads{static_cast<int>(partitions.size()) + std::max(_options.workers, 1)};
+
+            for (std::size_t i = 0; i < partitions.size(); ++i) {
+                thread_pool::post(threads, [this, i, &partitions, &_conn_pool, &queue, &merge] {
+                    irods::at_scope_exit<std::function<void()>> done{[&queue] { queue.producer_done(); }};
+
+                    errors local_errs;
+                    const auto prefix = "partition " + std::to_string(i) + ": ";
+
+                    try {
+                        auto conn = _conn_pool.get_connection();
+                        ConnectionType& comm = conn;
+                        auto& [input, limit] = partitions[i];
+
+                        query<ConnectionType> q{&comm, input, limit, options_};
+
+                        q.for_each_page([this, &queue](const auto& _page) {
+                            if (cancelled()) {
+                                return false;
+                            }
+
+                            // The page is only valid until the next one is
+                            // fetched, so the workers get a copy.
+                            queue.push(owned_page{_page});
+
+                            return !cancelled();
+                        });
+                    }
+                    catch (const irods::exception& e) {
+                        report(local_errs, {e.code(), prefix + e.what()});
+                    }
+                    catch (const std::exception& e) {
+                        report(local_errs, {SYS_UNKNOWN_ERROR, prefix + e.what()});
+                    }
+                    catch (...) {
+                        report(local_errs, {SYS_UNKNOWN_ERROR, prefix + "Unknown error occurred while fetching rows."});
+                    }
+
+                    merge(local_errs);
+                });
+            }
+
+            for (int i = 0; i < std::max(_options.workers, 1); ++i) {
+                thread_pool::post(threads, [this, &queue, &merge] {
+                    errors local_errs;
+
+                    // Pages are drained even after cancellation so that no
+                    // fetcher stays blocked on a full queue.
+                    while (auto page = queue.pop()) {
+                        if (!cancelled()) {
+                            process_page(page->view(), local_errs);
+                        }
+                    }
+
+                    merge(local_errs);
+                });
+            }
+
+            threads.join();
+
+            return errs;
+        }
+
         std::string query_;
         job job_;
+        batch_job batch_job_;
         uint32_t limit_;
         query_type type_;
+        query_options options_;
+        error_sink error_sink_;
+        std::mutex error_sink_mutex_;
     };
 } // namespace irods
 
@@ -0,0 +1,167 @@
+#ifndef IRODS_SHARDED_CONNECTION_POOL_HPP
+#define IRODS_SHARDED_CONNECTION_POOL_HPP
+
+#include "connection_pool.hpp"
+
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace irods
+{
+    struct connection_endpoint
+    {
+        std::string host;
+        int port;
+    };
+
+    enum class routing_policy
+    {
+        least_loaded,   // Route to the endpoint with the fewest connections checked out.
+        lowest_latency  // Route to the endpoint with the lowest measured round-trip time.
+    };
+
+    struct sharded_connection_pool_options
+    {
+        // Options applied to the connection pool of every endpoint.
+        connection_pool_options pool_options{};
+
+        routing_policy policy = routing_policy::least_loaded;
+
+        // How long an endpoint is ejected after a failure. The backoff
+        // doubles on every consecutive failure up to "max_backoff".
+        std::chrono::seconds initial_backoff{5};
+        std::chrono::seconds max_backoff{300};
+
+        // How long to wait for a connection from one endpoint before trying
+        // the next one. Only when every endpoint is busy does a checkout
+        // wait for as long as it takes.
+        std::chrono::milliseconds failover_timeout{100};
+
+        // How often the round-trip time to an endpoint is measured. The
+        // measurement is a small query run by a background thread, so
+        // checkouts never wait for it.
+        std::chrono::seconds latency_probe_interval{10};
+    };
+
+    // A pool of connection pools, one per endpoint. Checkouts are routed to
+    // the best endpoint according to the routing policy. Endpoints that fail
+    // to connect are ejected. A background thread reconnects them after a
+    // backoff period, and checkouts skip them until it succeeds.
+    class sharded_connection_pool
+    {
+    private:
+        struct shard;
+
+    public:
+        // A wrapper around a connection from one of the endpoint pools.
+        // On destruction, the underlying connection is immediately returned
+        // to the pool it came from.
+        class connection_proxy
+        {
+        public:
+            friend class sharded_connection_pool;
+
+            connection_proxy(connection_proxy&&);
+            connection_proxy& operator=(connection_proxy&&);
+
+            ~connection_proxy();
+
+            operator rcComm_t&() const noexcept;
+
+            const connection_endpoint& endpoint() const noexcept;
+
+            connection_pool::clock_type::duration wait_time() const noexcept;
+
+            void report_socket_error() noexcept;
+
+        private:
+            connection_proxy(std::shared_ptr<connection_pool> _pool,
+                             connection_pool::connection_proxy&& _conn,
+                             shard& _shard) noexcept;
+
+            // Keeps the endpoint pool alive while the connection is checked
+            // out, even if the endpoint is ejected in the meantime.
+            std::shared_ptr<connection_pool> pool_;
+            connection_pool::connection_proxy conn_;
+            shard* shard_;
+        };
+
+        sharded_connection_pool(const std::vector<connection_endpoint>& _endpoints,
+                                int _size_per_endpoint,
+                                const std::string& _username,
+                                const std::string& _zone,
+                                const int _refresh_time,
+                                const sharded_connection_pool_options& _options = {});
+
+        sharded_connection_pool(const sharded_connection_pool&) = delete;
+        sharded_connection_pool& operator=(const sharded_connection_pool&) = delete;
+
+        ~sharded_connection_pool();
+
+        // Checks out a connection from the best available endpoint. Throws
+        // if no endpoint is able to provide a connection.
+        connection_proxy get_connection();
+
+    private:
+        struct shard
+        {
+            connection_endpoint endpoint{};
+            std::mutex mutex{};
+            std::shared_ptr<connection_pool> pool{};
+            std::atomic<int> in_flight{};
+            std::atomic<std::int64_t> latency_us{};  // Zero until measured.
+
+            // Set while the endpoint is ejected and has no pool.
+            std::atomic<bool> reconnecting{};
+
+            // When the round-trip time is measured next. Only used by the
+            // maintenance thread.
+            connection_pool::clock_type::time_point next_probe_time{};
+
+            // When the maintenance thread tries to reconnect an ejected
+            // endpoint. Guarded by "mutex".
+            connection_pool::clock_type::time_point retry_time{};
+            std::chrono::seconds backoff{};
+        };
+
+        shard* select_shard(const std::vector<bool>& _excluded);
+
+        std::shared_ptr<connection_pool> current_pool(shard& _shard);
+
+        bool connect(shard& _shard);
+
+        void eject(shard& _shard, const std::shared_ptr<connection_pool>& _pool);
+
+        void schedule_retry(shard& _shard);
+
+        void run_maintenance();
+
+        connection_pool::clock_type::time_point next_maintenance_time();
+
+        void probe_latency(shard& _shard);
+
+        void record_latency(shard& _shard, connection_pool::clock_type::duration _latency) noexcept;
+
+        const int size_;
+        const std::string username_;
+        const std::string zone_;
+        const int refresh_time_;
+        const sharded_connection_pool_options options_;
+        std::vector<shard> shards_;
+
+        std::mutex maintenance_mutex_;
+        std::condition_variable maintenance_cv_;
+        bool maintenance_requested_;
+        bool stop_maintenance_;
+        std::thread maintenance_thread_;
+    };
+} // namespace irods
+
+#endif // IRODS_SHARDED_CONNECTION_POOL_HPP
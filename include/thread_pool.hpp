@@ -2,51 +2,506 @@
 #define IRODS_THREAD_POOL_HPP
 
 #include <utility>
-
-#include <boost/asio.hpp>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
 
 namespace irods
 {
+    // A point-in-time view of the activity of a thread pool. Latencies are
+    // measured from the moment a task is queued until it starts running.
+    struct thread_pool_metrics
+    {
+        std::size_t queue_depth{};
+        std::size_t peak_queue_depth{};
+
+        std::uint64_t tasks_completed{};
+        std::uint64_t tasks_dropped{};   // Discarded by the drop_oldest policy.
+        std::uint64_t tasks_rejected{};  // Refused by try_post().
+
+        std::chrono::nanoseconds total_queue_latency{};
+        std::chrono::nanoseconds max_queue_latency{};
+        std::chrono::nanoseconds total_run_time{};
+    };
+
+    // A work-stealing thread pool. Each worker owns a queue per priority lane.
+    // Idle workers take work from other workers' queues. Work in the high
+    // priority lane of any worker is always run before normal priority work.
     class thread_pool
     {
     public:
+        enum class priority
+        {
+            high,   // Latency-sensitive work (e.g. stat and metadata calls).
+            normal  // Everything else (e.g. bulk transfer chunks).
+        };
+
+        // What post() does when a bounded pool is full.
+        enum class overflow_policy
+        {
+            block,       // Wait until a queued task has been started.
+            drop_oldest  // Discard the oldest queued task, preferring normal priority work.
+        };
+
         explicit thread_pool(int _size)
-            : pool_{static_cast<std::size_t>(_size)}
+            : thread_pool{_size, 0, overflow_policy::block}
+        {
+        }
+
+        // Creates a pool that holds at most "_max_queued_tasks" tasks that have
+        // not been started yet. Zero means the queue is unbounded.
+        //
+        // Tasks submitted from one of the pool's own threads never block,
+        // because blocking a worker on its own queue can deadlock the pool.
+        thread_pool(int _size, std::size_t _max_queued_tasks, overflow_policy _policy)
+            : workers_(static_cast<std::size_t>(std::max(_size, 1)))
+            , threads_{}
+            , next_worker_{}
+            , pending_{}
+            , outstanding_{}
+            , sleeping_{}
+            , max_queued_{_max_queued_tasks}
+            , policy_{_policy}
+            , reserved_{}
+            , blocked_producers_{}
+            , counters_{}
+            , mutex_{}
+            , cv_{}
+            , space_cv_{}
+            , stopped_{}
+            , joining_{}
+        {
+            threads_.reserve(workers_.size());
+
+            for (std::size_t i = 0; i < workers_.size(); ++i) {
+                threads_.emplace_back([this, i] { run(i); });
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool()
         {
+            stop();
+            join();
         }
 
+        // Blocks until all threads have exited. If stop() has not been called,
+        // this waits until there is no more outstanding work.
         void join()
         {
-            pool_.join();
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                joining_ = true;
+            }
+
+            cv_.notify_all();
+
+            for (auto& t : threads_) {
+                if (t.joinable()) {
+                    t.join();
+                }
+            }
         }
 
+        // Causes the threads to exit as soon as possible. Work that has not
+        // been started is abandoned.
         void stop()
         {
-            pool_.stop();
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                stopped_.store(true);
+            }
+
+            cv_.notify_all();
+            space_cv_.notify_all();
+        }
+
+        thread_pool_metrics metrics() const
+        {
+            using std::chrono::nanoseconds;
+
+            thread_pool_metrics m;
+
+            m.queue_depth = pending_.load();
+            m.peak_queue_depth = counters_.peak_queue_depth.load();
+            m.tasks_completed = counters_.tasks_completed.load();
+            m.tasks_dropped = counters_.tasks_dropped.load();
+            m.tasks_rejected = counters_.tasks_rejected.load();
+            m.total_queue_latency = nanoseconds{counters_.total_queue_latency_ns.load()};
+            m.max_queue_latency = nanoseconds{counters_.max_queue_latency_ns.load()};
+            m.total_run_time = nanoseconds{counters_.total_run_time_ns.load()};
+
+            return m;
         }
 
+        // Runs "_func" immediately if called from one of the pool's threads.
+        // Otherwise, the function is posted to the pool.
         template <typename Function>
         static void dispatch(thread_pool& _pool, Function&& _func)
         {
-            boost::asio::dispatch(_pool.pool_, std::forward<Function>(_func));
+            if (current_pool_ == &_pool) {
+                std::forward<Function>(_func)();
+                return;
+            }
+
+            _pool.submit(std::forward<Function>(_func), priority::normal, false);
+        }
+
+        // Queues "_func" only if the pool has room for it. Returns true if the
+        // function was queued.
+        template <typename Function>
+        static bool try_post(thread_pool& _pool, Function&& _func)
+        {
+            return try_post(_pool, priority::normal, std::forward<Function>(_func));
+        }
+
+        template <typename Function>
+        static bool try_post(thread_pool& _pool, priority _priority, Function&& _func)
+        {
+            if (!_pool.try_reserve_slot()) {
+                ++_pool.counters_.tasks_rejected;
+                return false;
+            }
+
+            _pool.enqueue(std::forward<Function>(_func), _priority, false);
+
+            return true;
         }
 
         template <typename Function>
         static void post(thread_pool& _pool, Function&& _func)
         {
-            boost::asio::post(_pool.pool_, std::forward<Function>(_func));
+            _pool.submit(std::forward<Function>(_func), priority::normal, false);
+        }
+
+        template <typename Function>
+        static void post(thread_pool& _pool, priority _priority, Function&& _func)
+        {
+            _pool.submit(std::forward<Function>(_func), _priority, false);
         }
 
+        // Like post(), but when called from one of the pool's threads, the
+        // function is queued on the calling thread's own queue.
         template <typename Function>
         static void defer(thread_pool& _pool, Function&& _func)
         {
-            boost::asio::defer(_pool.pool_, std::forward<Function>(_func));
+            _pool.submit(std::forward<Function>(_func), priority::normal, true);
         }
 
     private:
-        boost::asio::thread_pool pool_;
+        using clock_type = std::chrono::steady_clock;
+
+        // A type-erased, move-only function object. std::function cannot be
+        // used because handlers may capture move-only objects (e.g. promises).
+        class task
+        {
+        public:
+            task() = default;
+
+            template <typename Function>
+            explicit task(Function&& _func)
+                : impl_{std::make_unique<impl<std::decay_t<Function>>>(std::forward<Function>(_func))}
+                , enqueue_time_{clock_type::now()}
+            {
+            }
+
+            void operator()() { impl_->invoke(); }
+
+            clock_type::time_point enqueue_time() const noexcept { return enqueue_time_; }
+
+        private:
+            struct base
+            {
+                virtual ~base() = default;
+                virtual void invoke() = 0;
+            };
+
+            template <typename Function>
+            struct impl : base
+            {
+                explicit impl(Function&& _func) : func{std::move(_func)} {}
+                explicit impl(const Function& _func) : func{_func} {}
+
+                void invoke() override { func(); }
+
+                Function func;
+            };
+
+            std::unique_ptr<base> impl_;
+            clock_type::time_point enqueue_time_;
+        };
+
+        inline static constexpr std::size_t lane_count = 2;
+
+        struct worker
+        {
+            std::mutex mutex{};
+            std::array<std::deque<task>, lane_count> lanes{};
+        };
+
+        struct metric_counters
+        {
+            std::atomic<std::size_t> peak_queue_depth{};
+            std::atomic<std::uint64_t> tasks_completed{};
+            std::atomic<std::uint64_t> tasks_dropped{};
+            std::atomic<std::uint64_t> tasks_rejected{};
+            std::atomic<std::int64_t> total_queue_latency_ns{};
+            std::atomic<std::int64_t> max_queue_latency_ns{};
+            std::atomic<std::int64_t> total_run_time_ns{};
+        };
+
+        template <typename T>
+        static void store_max(std::atomic<T>& _max, T _value) noexcept
+        {
+            auto current = _max.load();
+            while (current < _value && !_max.compare_exchange_weak(current, _value));
+        }
+
+        // Reserves room for one task in a bounded pool. Room is given back
+        // when a task is taken off a queue.
+        bool try_reserve_slot() noexcept
+        {
+            if (max_queued_ == 0) {
+                ++reserved_;
+                return true;
+            }
+
+            auto n = reserved_.load();
+
+            while (n < max_queued_) {
+                if (reserved_.compare_exchange_weak(n, n + 1)) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void release_slot()
+        {
+            --reserved_;
+
+            if (blocked_producers_.load() > 0) {
+                std::lock_guard<std::mutex> lock{mutex_};
+                space_cv_.notify_one();
+            }
+        }
+
+        // Removes the oldest queued task, preferring normal priority work.
+        // The slot held by the dropped task is not released. It is handed to
+        // the task that caused the drop.
+        bool drop_oldest()
+        {
+            for (std::size_t lane = lane_count; lane-- > 0;) {
+                // Tasks are spread across the workers, and each queue is in
+                // the order its tasks were posted, so the oldest task is the
+                // oldest of the queue fronts. Workers take tasks while the
+                // queues are compared, so the search is repeated until the
+                // chosen task is still at the front of its queue.
+                while (true) {
+                    worker* oldest = nullptr;
+                    clock_type::time_point oldest_time{};
+
+                    for (auto& w : workers_) {
+                        std::lock_guard<std::mutex> lock{w.mutex};
+
+                        if (auto& q = w.lanes[lane]; !q.empty() && (!oldest || q.front().enqueue_time() < oldest_time)) {
+                            oldest = &w;
+                            oldest_time = q.front().enqueue_time();
+                        }
+                    }
+
+                    if (!oldest) {
+                        break;
+                    }
+
+                    task dropped;
+
+                    {
+                        std::lock_guard<std::mutex> lock{oldest->mutex};
+
+                        auto& q = oldest->lanes[lane];
+
+                        if (q.empty() || q.front().enqueue_time() != oldest_time) {
+                            continue;
+                        }
+
+                        dropped = std::move(q.front());
+                        q.pop_front();
+                    }
+
+                    --pending_;
+                    --outstanding_;
+                    ++counters_.tasks_dropped;
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        template <typename Function>
+        void submit(Function&& _func, priority _priority, bool _prefer_local)
+        {
+            const auto on_worker = current_pool_ == this;
+
+            while (!try_reserve_slot()) {
+                if (on_worker) {
+                    // Never block or drop work on behalf of a worker. Going
+                    // over the limit is preferable to deadlocking the pool.
+                    ++reserved_;
+                    break;
+                }
+
+                if (overflow_policy::drop_oldest == policy_) {
+                    if (drop_oldest()) {
+                        break;
+                    }
+
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock{mutex_};
+
+                ++blocked_producers_;
+                space_cv_.wait(lock, [this] { return stopped_.load() || reserved_.load() < max_queued_; });
+                --blocked_producers_;
+
+                if (stopped_.load()) {
+                    return;
+                }
+            }
+
+            enqueue(std::forward<Function>(_func), _priority, _prefer_local);
+        }
+
+        template <typename Function>
+        void enqueue(Function&& _func, priority _priority, bool _prefer_local)
+        {
+            // Work posted from a worker stays on that worker when requested.
+            // Otherwise, work is spread across the workers round-robin.
+            const auto index = (_prefer_local && current_pool_ == this)
+                ? current_worker_
+                : next_worker_++ % workers_.size();
+
+            ++outstanding_;
+
+            {
+                auto& w = workers_[index];
+                std::lock_guard<std::mutex> lock{w.mutex};
+                w.lanes[static_cast<std::size_t>(_priority)].emplace_back(std::forward<Function>(_func));
+            }
+
+            store_max(counters_.peak_queue_depth, ++pending_);
+
+            if (sleeping_.load() > 0) {
+                std::lock_guard<std::mutex> lock{mutex_};
+                cv_.notify_one();
+            }
+        }
+
+        bool try_pop(std::size_t _index, task& _task)
+        {
+            // Drain the high priority lanes of all workers before touching
+            // any normal priority work. Each worker starts with its own queue.
+            for (std::size_t lane = 0; lane < lane_count; ++lane) {
+                for (std::size_t n = 0; n < workers_.size(); ++n) {
+                    auto& w = workers_[(_index + n) % workers_.size()];
+                    std::lock_guard<std::mutex> lock{w.mutex};
+
+                    if (auto& q = w.lanes[lane]; !q.empty()) {
+                        _task = std::move(q.front());
+                        q.pop_front();
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        void run(std::size_t _index)
+        {
+            current_pool_ = this;
+            current_worker_ = _index;
+
+            while (true) {
+                if (task t; pending_.load() > 0 && try_pop(_index, t)) {
+                    --pending_;
+                    release_slot();
+
+                    if (stopped_.load()) {
+                        return;
+                    }
+
+                    const auto start = clock_type::now();
+                    const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(start - t.enqueue_time()).count();
+                    counters_.total_queue_latency_ns += latency;
+                    store_max(counters_.max_queue_latency_ns, static_cast<std::int64_t>(latency));
+
+                    t();
+
+                    counters_.total_run_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count();
+                    ++counters_.tasks_completed;
+
+                    if (--outstanding_ == 0) {
+                        std::lock_guard<std::mutex> lock{mutex_};
+                        cv_.notify_all();
+                    }
+
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock{mutex_};
+
+                ++sleeping_;
+                cv_.wait(lock, [this] {
+                    return stopped_ || pending_.load() > 0 || (joining_ && outstanding_.load() == 0);
+                });
+                --sleeping_;
+
+                if (stopped_ || (joining_ && outstanding_.load() == 0)) {
+                    return;
+                }
+            }
+        }
+
+        inline static thread_local const thread_pool* current_pool_ = nullptr;
+        inline static thread_local std::size_t current_worker_ = 0;
+
+        std::vector<worker> workers_;
+        std::vector<std::thread> threads_;
+
+        std::atomic<std::size_t> next_worker_;
+        std::atomic<std::size_t> pending_;      // Queued tasks.
+        std::atomic<std::size_t> outstanding_;  // Queued and running tasks.
+        std::atomic<int> sleeping_;
+
+        const std::size_t max_queued_;
+        const overflow_policy policy_;
+        std::atomic<std::size_t> reserved_;  // Queue slots in use or being filled.
+        std::atomic<int> blocked_producers_;
+
+        metric_counters counters_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::condition_variable space_cv_;  // Signaled when a queue slot is released.
+        std::atomic<bool> stopped_;
+        bool joining_;
     };
 } // namespace irods
 
 #endif // IRODS_THREAD_POOL_HPP
-
@@ -0,0 +1,250 @@
+#ifndef IRODS_IO_COALESCING_READER_HPP
+#define IRODS_IO_COALESCING_READER_HPP
+
+#include "buffer_pool.hpp"
+#include "transport/transport.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace irods::experimental::io
+{
+    struct coalescing_options
+    {
+        // How long the first request of a batch waits for others to arrive.
+        std::chrono::microseconds window{500};
+
+        // Requests separated by at most this many characters are merged. The
+        // characters in between are read and thrown away.
+        std::size_t max_gap = 0;
+
+        // The largest read a batch of merged requests may turn into.
+        std::size_t max_merged_size = 8 * 1024 * 1024;
+    };
+
+    // Serves positional reads for several threads over one transport and
+    // merges requests for adjacent ranges into a single receive_at() call.
+    //
+    //     client::default_transport tp{conn};
+    //     tp.open("/tempZone/home/rods/foo.parquet", std::ios_base::in);
+    //
+    //     coalescing_reader reader{tp};
+    //     auto footer = reader.read_at(size - 8, buf, 8);
+    //     auto meta   = reader.read_at(size - 8 - n, meta_buf, n);
+    //     footer.get();
+    //     meta.get();
+    //
+    // Requests are collected for a short window, sorted by offset and merged
+    // with their neighbors. Each merged range is read once and copied out to
+    // the requests it covers. A request that is not merged with any other is
+    // read directly into its own buffer.
+    //
+    // The transport must stay open while the reader exists and must not be
+    // used by anything else in the meantime.
+    template <typename CharT>
+    class basic_coalescing_reader
+    {
+    public:
+        // clang-format off
+        using char_type = CharT;
+        using off_type  = typename transport<CharT>::off_type;
+        // clang-format on
+
+        explicit basic_coalescing_reader(transport<CharT>& _transport, const coalescing_options& _options = {})
+            : transport_{&_transport}
+            , options_{_options}
+            , mutex_{}
+            , cv_{}
+            , requests_{}
+            , stop_{}
+            , thread_{}
+        {
+            thread_ = std::thread{[this] { run(); }};
+        }
+
+        basic_coalescing_reader(const basic_coalescing_reader&) = delete;
+        basic_coalescing_reader& operator=(const basic_coalescing_reader&) = delete;
+
+        // Requests that have already been made are completed first.
+        ~basic_coalescing_reader()
+        {
+            {
+                std::lock_guard lk{mutex_};
+                stop_ = true;
+            }
+
+            cv_.notify_one();
+            thread_.join();
+        }
+
+        // Reads up to "_size" characters starting at "_offset" into "_buffer",
+        // which must stay valid until the future is ready. The future holds
+        // the number of characters read, or a negative error code.
+        std::future<std::streamsize> read_at(off_type _offset, char_type* _buffer, std::streamsize _size)
+        {
+            request r{_offset, _buffer, std::max<std::streamsize>(_size, 0), {}};
+            auto f = r.promise.get_future();
+
+            {
+                std::lock_guard lk{mutex_};
+                requests_.push_back(std::move(r));
+            }
+
+            cv_.notify_one();
+
+            return f;
+        }
+
+        // Like read_at(), but waits for the result.
+        std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _size)
+        {
+            return read_at(_offset, _buffer, _size).get();
+        }
+
+    private:
+        struct request
+        {
+            off_type offset;
+            char_type* buffer;
+            std::streamsize size;
+            std::promise<std::streamsize> promise;
+
+            off_type end() const noexcept
+            {
+                return offset + size;
+            }
+        };
+
+        using request_iterator = typename std::vector<request>::iterator;
+
+        void run()
+        {
+            std::unique_lock lk{mutex_};
+
+            while (true) {
+                cv_.wait(lk, [this] { return stop_ || !requests_.empty(); });
+
+                if (requests_.empty()) {
+                    return;
+                }
+
+                // Give requests made close together a chance to be merged.
+                const auto deadline = std::chrono::steady_clock::now() + options_.window;
+                cv_.wait_until(lk, deadline, [this] { return stop_ || pending_size() >= options_.max_merged_size; });
+
+                auto batch = std::move(requests_);
+                requests_.clear();
+                lk.unlock();
+
+                process(batch);
+
+                lk.lock();
+            }
+        }
+
+        std::size_t pending_size() const noexcept
+        {
+            std::size_t size = 0;
+
+            for (const auto& r : requests_) {
+                size += static_cast<std::size_t>(r.size);
+            }
+
+            return size;
+        }
+
+        void process(std::vector<request>& _batch)
+        {
+            std::sort(std::begin(_batch), std::end(_batch), [](const auto& _a, const auto& _b) {
+                return _a.offset < _b.offset;
+            });
+
+            const auto max_gap = static_cast<off_type>(options_.max_gap);
+            const auto max_size = static_cast<off_type>(options_.max_merged_size);
+
+            for (auto first = std::begin(_batch); first != std::end(_batch);) {
+                auto last = std::next(first);
+                auto end = first->end();
+
+                while (last != std::end(_batch) &&
+                       last->offset <= end + max_gap &&
+                       std::max(end, last->end()) - first->offset <= max_size)
+                {
+                    end = std::max(end, last->end());
+                    ++last;
+                }
+
+                read_range(first, last, end);
+                first = last;
+            }
+        }
+
+        // Reads [_first->offset, _end) once and hands each request in
+        // [_first, _last) its part.
+        void read_range(request_iterator _first, request_iterator _last, off_type _end)
+        {
+            if (std::next(_first) == _last) {
+                try {
+                    _first->promise.set_value(transport_->receive_at(_first->offset, _first->buffer, _first->size));
+                }
+                catch (...) {
+                    _first->promise.set_exception(std::current_exception());
+                }
+
+                return;
+            }
+
+            const auto start = _first->offset;
+            const auto size = static_cast<std::streamsize>(_end - start);
+
+            std::streamsize bytes_read{};
+            buffer_pool::buffer buffer;
+
+            try {
+                buffer = buffer_pool::instance().acquire(static_cast<std::size_t>(size) * sizeof(char_type));
+                bytes_read = transport_->receive_at(start, reinterpret_cast<char_type*>(buffer.data()), size);
+            }
+            catch (...) {
+                for (auto it = _first; it != _last; ++it) {
+                    it->promise.set_exception(std::current_exception());
+                }
+
+                return;
+            }
+
+            const auto* data = reinterpret_cast<const char_type*>(buffer.data());
+
+            for (auto it = _first; it != _last; ++it) {
+                if (bytes_read < 0) {
+                    it->promise.set_value(bytes_read);
+                    continue;
+                }
+
+                const auto skip = static_cast<std::streamsize>(it->offset - start);
+                const auto n = std::clamp<std::streamsize>(bytes_read - skip, 0, it->size);
+
+                std::memcpy(it->buffer, data + skip, static_cast<std::size_t>(n) * sizeof(char_type));
+                it->promise.set_value(n);
+            }
+        }
+
+        transport<CharT>* transport_;
+        const coalescing_options options_;
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<request> requests_;
+        bool stop_;
+        std::thread thread_;
+    }; // basic_coalescing_reader
+
+    using coalescing_reader = basic_coalescing_reader<char>;
+} // irods::experimental::io
+
+#endif // IRODS_IO_COALESCING_READER_HPP
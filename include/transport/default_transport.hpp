@@ -68,10 +68,12 @@ namespace irods::experimental::io::NAMESPACE_IMPL
         // clang-format off
         inline static constexpr auto uninitialized_file_descriptor = -1;
         inline static constexpr auto minimum_valid_file_descriptor = 3;
+        inline static constexpr auto unknown_position              = off_type{-1};
 
         // Errors
         inline static constexpr auto translation_error             = -1;
         inline static const     auto seek_error                    = pos_type{off_type{-1}};
+        inline static constexpr auto positioning_error             = std::streamsize{-1};
         // clang-format on
 
     public:
@@ -79,6 +81,8 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             : transport<CharT>{}
             , comm_{&_comm}
             , fd_{uninitialized_file_descriptor}
+            , position_{unknown_position}
+            , append_{}
         {
         }
 
@@ -127,6 +131,7 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             }
 
             fd_ = uninitialized_file_descriptor;
+            position_ = unknown_position;
 
             return true;
         }
@@ -143,7 +148,10 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             output.len = input.len;
             output.buf = _buffer;
 
-            return rxDataObjRead(comm_, &input, &output);
+            const auto bytes_read = rxDataObjRead(comm_, &input, &output);
+            advance_position(bytes_read);
+
+            return bytes_read;
         }
 
         std::streamsize send(const char_type* _buffer, std::streamsize _buffer_size) override
@@ -158,7 +166,38 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             input_buffer.len = input.len;
             input_buffer.buf = const_cast<char_type*>(_buffer);
 
-            return rxDataObjWrite(comm_, &input, &input_buffer);
+            const auto bytes_written = rxDataObjWrite(comm_, &input, &input_buffer);
+
+            if (append_) {
+                position_ = unknown_position;
+            }
+            else {
+                advance_position(bytes_written);
+            }
+
+            return bytes_written;
+        }
+
+        // The position of the descriptor is tracked locally, so a positional
+        // transfer that continues where the previous one ended costs a single
+        // round trip. The data object API has no positional read or write, so
+        // any other offset needs a seek first.
+        std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (!move_to(_offset)) {
+                return positioning_error;
+            }
+
+            return receive(_buffer, _buffer_size);
+        }
+
+        std::streamsize send_at(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (!move_to(_offset)) {
+                return positioning_error;
+            }
+
+            return send(_buffer, _buffer_size);
         }
 
         pos_type seekpos(off_type _offset, std::ios_base::seekdir _dir) override
@@ -192,9 +231,12 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             fileLseekOut_t* output{};
 
             if (const auto ec = rxDataObjLseek(comm_, &input, &output); ec < 0) {
+                position_ = unknown_position;
                 return seek_error;
             }
 
+            position_ = output->offset;
+
             return output->offset;
         }
 
@@ -277,6 +319,11 @@ namespace irods::experimental::io::NAMESPACE_IMPL
 
             fd_ = fd;
 
+            // Writes in append mode always go to the end of the data object,
+            // so the position is not tracked across them.
+            append_ = flags & O_APPEND;
+            position_ = 0;
+
             if (!seek_to_end_if_required(_mode)) {
                 close();
                 return false;
@@ -285,8 +332,25 @@ namespace irods::experimental::io::NAMESPACE_IMPL
             return true;
         }
 
+        void advance_position(std::streamsize _count) noexcept
+        {
+            if (_count < 0) {
+                position_ = unknown_position;
+            }
+            else if (position_ != unknown_position) {
+                position_ += _count;
+            }
+        }
+
+        bool move_to(off_type _offset)
+        {
+            return position_ == _offset || seekpos(_offset, std::ios_base::beg) != seek_error;
+        }
+
         rxComm* comm_;
         int fd_;
+        off_type position_;
+        bool append_;
     }; // basic_transport
 
     using default_transport = basic_transport<char>;
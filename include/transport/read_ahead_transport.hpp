@@ -0,0 +1,338 @@
+#ifndef IRODS_IO_READ_AHEAD_TRANSPORT_HPP
+#define IRODS_IO_READ_AHEAD_TRANSPORT_HPP
+
+#include "buffer_pool.hpp"
+#include "transport/transport.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace irods::experimental::io
+{
+    // A transport that reads ahead of the consumer once it notices that a
+    // data object is being read sequentially. It wraps another transport
+    // (e.g. client::default_transport), which it does not own.
+    //
+    //     client::default_transport tp{conn};
+    //     read_ahead_transport ra{tp};
+    //     idstream in{ra, "/tempZone/home/rods/foo"};
+    //
+    // After "_sequential_reads" consecutive calls to receive(), a background
+    // thread starts reading chunks the size of the last request and keeps up
+    // to "_depth" of them ready, so the network stays busy while the consumer
+    // processes the previous chunk. Any call to seekpos() or send() stops the
+    // background thread, moves the wrapped transport back to the consumer's
+    // position and returns to reading on demand.
+    //
+    // The wrapped transport is only used by one thread at a time, so a
+    // connection is never shared by concurrent API calls.
+    template <typename CharT>
+    class basic_read_ahead_transport : public transport<CharT>
+    {
+    public:
+        // clang-format off
+        using char_type   = typename transport<CharT>::char_type;
+        using traits_type = typename transport<CharT>::traits_type;
+        using int_type    = typename traits_type::int_type;
+        using pos_type    = typename traits_type::pos_type;
+        using off_type    = typename traits_type::off_type;
+        // clang-format on
+
+        explicit basic_read_ahead_transport(transport<CharT>& _transport,
+                                            int _depth = 2,
+                                            int _sequential_reads = 2)
+            : transport<CharT>{}
+            , transport_{&_transport}
+            , depth_{std::max(_depth, 1)}
+            , sequential_reads_threshold_{std::max(_sequential_reads, 1)}
+            , sequential_reads_{}
+            , chunk_size_{}
+            , mutex_{}
+            , data_ready_{}
+            , space_ready_{}
+            , chunks_{}
+            , prefetcher_{}
+            , stop_{}
+            , error_{}
+        {
+        }
+
+        basic_read_ahead_transport(const basic_read_ahead_transport&) = delete;
+        basic_read_ahead_transport& operator=(const basic_read_ahead_transport&) = delete;
+
+        ~basic_read_ahead_transport()
+        {
+            stop_prefetching();
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  std::ios_base::openmode _mode) override
+        {
+            discard();
+            return transport_->open(_p, _mode);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  int _replica_number,
+                  std::ios_base::openmode _mode) override
+        {
+            discard();
+            return transport_->open(_p, _replica_number, _mode);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  const std::string& _resource_name,
+                  std::ios_base::openmode _mode) override
+        {
+            discard();
+            return transport_->open(_p, _resource_name, _mode);
+        }
+
+        bool close() override
+        {
+            discard();
+            return transport_->close();
+        }
+
+        std::streamsize receive(char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (prefetcher_.joinable()) {
+                return receive_prefetched(_buffer, _buffer_size);
+            }
+
+            const auto bytes_read = transport_->receive(_buffer, _buffer_size);
+
+            if (bytes_read > 0 && ++sequential_reads_ >= sequential_reads_threshold_) {
+                start_prefetching(_buffer_size * sizeof(char_type));
+            }
+
+            return bytes_read;
+        }
+
+        std::streamsize send(const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (!reset()) {
+                return -1;
+            }
+
+            return transport_->send(_buffer, _buffer_size);
+        }
+
+        // Positional transfers go straight to the wrapped transport. The data
+        // read ahead is discarded because the position is about to change.
+        std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            discard();
+            return transport_->receive_at(_offset, _buffer, _buffer_size);
+        }
+
+        std::streamsize send_at(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            discard();
+            return transport_->send_at(_offset, _buffer, _buffer_size);
+        }
+
+        pos_type seekpos(off_type _offset, std::ios_base::seekdir _dir) override
+        {
+            // The wrapped transport is ahead of the consumer by the number
+            // of bytes that were prefetched but not yet received.
+            const auto unconsumed = stop_prefetching();
+            sequential_reads_ = 0;
+
+            if (std::ios_base::cur == _dir) {
+                _offset -= unconsumed;
+            }
+
+            return transport_->seekpos(_offset, _dir);
+        }
+
+        bool is_open() const noexcept override
+        {
+            return transport_->is_open();
+        }
+
+        int file_descriptor() const noexcept override
+        {
+            return transport_->file_descriptor();
+        }
+
+    private:
+        struct chunk
+        {
+            buffer_pool::buffer buffer;
+            std::streamsize size;    // The result of the read, or an error code.
+            std::streamsize offset;  // The number of bytes already consumed.
+        };
+
+        void start_prefetching(std::size_t _chunk_size)
+        {
+            chunk_size_ = _chunk_size;
+            stop_ = false;
+            error_ = nullptr;
+            prefetcher_ = std::thread{[this] { prefetch(); }};
+        }
+
+        // Stops the background thread and discards everything it read.
+        // Returns the number of discarded bytes.
+        off_type stop_prefetching()
+        {
+            if (!prefetcher_.joinable()) {
+                return 0;
+            }
+
+            {
+                std::lock_guard lk{mutex_};
+                stop_ = true;
+            }
+
+            space_ready_.notify_one();
+            prefetcher_.join();
+
+            off_type unconsumed = 0;
+
+            for (const auto& c : chunks_) {
+                if (c.size > 0) {
+                    unconsumed += (c.size - c.offset) / sizeof(char_type);
+                }
+            }
+
+            chunks_.clear();
+
+            return unconsumed;
+        }
+
+        // Returns to reading on demand without restoring the position of the
+        // wrapped transport.
+        void discard()
+        {
+            stop_prefetching();
+            sequential_reads_ = 0;
+        }
+
+        // Returns to reading on demand, moving the wrapped transport back to
+        // the consumer's position if data had been read ahead.
+        bool reset()
+        {
+            const auto unconsumed = stop_prefetching();
+            sequential_reads_ = 0;
+
+            if (unconsumed > 0) {
+                return transport_->seekpos(-unconsumed, std::ios_base::cur) != pos_type{off_type{-1}};
+            }
+
+            return true;
+        }
+
+        void prefetch()
+        {
+            try {
+                while (true) {
+                    {
+                        std::unique_lock lk{mutex_};
+                        space_ready_.wait(lk, [this] { return stop_ || static_cast<int>(chunks_.size()) < depth_; });
+
+                        if (stop_) {
+                            return;
+                        }
+                    }
+
+                    auto buffer = buffer_pool::instance().acquire(chunk_size_);
+                    auto* p = reinterpret_cast<char_type*>(buffer.data());
+                    const auto bytes_read = transport_->receive(p, chunk_size_ / sizeof(char_type));
+
+                    {
+                        std::lock_guard lk{mutex_};
+                        chunks_.push_back({std::move(buffer), bytes_read * static_cast<std::streamsize>(sizeof(char_type)), 0});
+                    }
+
+                    data_ready_.notify_one();
+
+                    // Nothing follows the end of the data object or an error.
+                    if (bytes_read <= 0) {
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                {
+                    std::lock_guard lk{mutex_};
+                    error_ = std::current_exception();
+                }
+
+                data_ready_.notify_one();
+            }
+        }
+
+        std::streamsize receive_prefetched(char_type* _buffer, std::streamsize _buffer_size)
+        {
+            auto* dst = reinterpret_cast<char*>(_buffer);
+            const auto bytes_requested = _buffer_size * static_cast<std::streamsize>(sizeof(char_type));
+            std::streamsize bytes_copied = 0;
+
+            std::unique_lock lk{mutex_};
+
+            while (bytes_copied < bytes_requested) {
+                data_ready_.wait(lk, [this] { return !chunks_.empty() || error_; });
+
+                if (chunks_.empty()) {
+                    if (bytes_copied > 0) {
+                        break;
+                    }
+
+                    auto e = error_;
+                    lk.unlock();
+                    reset();
+                    std::rethrow_exception(e);
+                }
+
+                auto& c = chunks_.front();
+
+                // The end of the data object or an error. The chunk is left in
+                // place so that the next call reports it as well.
+                if (c.size <= 0) {
+                    if (bytes_copied > 0) {
+                        break;
+                    }
+
+                    return c.size;
+                }
+
+                const auto n = std::min(c.size - c.offset, bytes_requested - bytes_copied);
+                std::memcpy(dst + bytes_copied, c.buffer.data() + c.offset, n);
+                bytes_copied += n;
+                c.offset += n;
+
+                if (c.offset == c.size) {
+                    chunks_.pop_front();
+                    space_ready_.notify_one();
+                }
+            }
+
+            return bytes_copied / static_cast<std::streamsize>(sizeof(char_type));
+        }
+
+        transport<CharT>* transport_;
+        const int depth_;
+        const int sequential_reads_threshold_;
+        int sequential_reads_;
+        std::size_t chunk_size_;
+
+        std::mutex mutex_;
+        std::condition_variable data_ready_;
+        std::condition_variable space_ready_;
+        std::deque<chunk> chunks_;
+        std::thread prefetcher_;
+        bool stop_;
+        std::exception_ptr error_;
+    }; // basic_read_ahead_transport
+
+    using read_ahead_transport = basic_read_ahead_transport<char>;
+} // irods::experimental::io
+
+#endif // IRODS_IO_READ_AHEAD_TRANSPORT_HPP
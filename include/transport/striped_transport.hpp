@@ -0,0 +1,466 @@
+#ifndef IRODS_IO_STRIPED_TRANSPORT_HPP
+#define IRODS_IO_STRIPED_TRANSPORT_HPP
+
+#include "connection_pool.hpp"
+#include "query.hpp"
+#include "thread_pool.hpp"
+#include "transport/default_transport.hpp"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace irods::experimental::io::client
+{
+    struct striped_transport_options
+    {
+        // The maximum number of connections used to move data. Fewer are used
+        // if the connection pool cannot spare them when the data object is
+        // opened.
+        int streams = 4;
+
+        // The size of the ranges each call to send() or receive() is split
+        // into. Ranges are handed to the streams round-robin.
+        std::size_t stripe_size = 4 * 1024 * 1024;
+    };
+
+    // A transport that opens the same data object on several pooled
+    // connections and moves large reads and writes over all of them at once.
+    //
+    //     irods::connection_pool pool{...};
+    //     client::striped_transport tp{pool};
+    //     idstream in{tp, "/tempZone/home/rods/foo", std::ios_base::in, 64 * 1024 * 1024};
+    //
+    // Each call to send() or receive() is split into ranges of "stripe_size"
+    // bytes. Every range is served by a seek plus a read or write on the
+    // descriptor of one stream, and received ranges land directly in their
+    // place in the caller's buffer, so data is always returned in order.
+    // Only requests larger than one stripe are split, so the stream should
+    // use a buffer of at least "streams * stripe_size" bytes.
+    //
+    // The position of the transport is tracked locally, so seeking relative
+    // to the beginning or the current position does not contact the server.
+    //
+    // Only reads are striped. Every stream reads the same replica: the one
+    // requested by the caller, or else a good replica picked when the data
+    // object is opened. Writes use a single stream, because the open API
+    // offers no way to attach more descriptors to the replica being written
+    // without each of them finalizing it on close. Callers can check
+    // stream_count() to see how many streams are in use.
+    //
+    // Opening in append mode is not supported.
+    template <typename CharT>
+    class basic_striped_transport : public transport<CharT>
+    {
+    public:
+        // clang-format off
+        using char_type   = typename transport<CharT>::char_type;
+        using traits_type = typename transport<CharT>::traits_type;
+        using int_type    = typename traits_type::int_type;
+        using pos_type    = typename traits_type::pos_type;
+        using off_type    = typename traits_type::off_type;
+        // clang-format on
+
+    private:
+        // clang-format off
+        inline static constexpr auto uninitialized_file_descriptor = -1;
+        inline static constexpr auto unknown_position              = off_type{-1};
+
+        // Errors
+        inline static constexpr auto seek_failed                   = std::streamsize{-1};
+        inline static const     auto seek_error                    = pos_type{off_type{-1}};
+        // clang-format on
+
+    public:
+        explicit basic_striped_transport(irods::connection_pool& _pool,
+                                         const striped_transport_options& _options = {})
+            : transport<CharT>{}
+            , pool_{&_pool}
+            , options_{_options}
+            , streams_{}
+            , workers_{}
+            , position_{}
+        {
+            options_.streams = std::max(options_.streams, 1);
+            options_.stripe_size = std::max<std::size_t>(options_.stripe_size, 1);
+        }
+
+        basic_striped_transport(const basic_striped_transport&) = delete;
+        basic_striped_transport& operator=(const basic_striped_transport&) = delete;
+
+        // Connections must not return to the pool with an open descriptor.
+        ~basic_striped_transport()
+        {
+            if (is_open()) {
+                close();
+            }
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  std::ios_base::openmode _mode) override
+        {
+            return open_impl(_p, _mode, std::nullopt, nullptr);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  int _replica_number,
+                  std::ios_base::openmode _mode) override
+        {
+            return open_impl(_p, _mode, _replica_number, nullptr);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  const std::string& _resource_name,
+                  std::ios_base::openmode _mode) override
+        {
+            return open_impl(_p, _mode, std::nullopt, &_resource_name);
+        }
+
+        bool close() override
+        {
+            if (!is_open()) {
+                return false;
+            }
+
+            workers_.reset();
+
+            // The stream that opened the data object is closed last.
+            bool closed = true;
+
+            for (auto it = std::rbegin(streams_); it != std::rend(streams_); ++it) {
+                closed = (*it)->transport.close() && closed;
+            }
+
+            streams_.clear();
+
+            return closed;
+        }
+
+        std::streamsize receive(char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            return transfer(_buffer, _buffer_size, [](auto& _tp, auto* _p, auto _n) {
+                return _tp.receive(_p, _n);
+            });
+        }
+
+        std::streamsize send(const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            return transfer(_buffer, _buffer_size, [](auto& _tp, auto* _p, auto _n) {
+                return _tp.send(_p, _n);
+            });
+        }
+
+        // The position is local, so positional transfers cost no more than
+        // send() and receive().
+        std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (_offset < 0) {
+                return seek_failed;
+            }
+
+            position_ = _offset;
+
+            return receive(_buffer, _buffer_size);
+        }
+
+        std::streamsize send_at(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (_offset < 0) {
+                return seek_failed;
+            }
+
+            position_ = _offset;
+
+            return send(_buffer, _buffer_size);
+        }
+
+        pos_type seekpos(off_type _offset, std::ios_base::seekdir _dir) override
+        {
+            if (!is_open()) {
+                return seek_error;
+            }
+
+            off_type new_position{};
+
+            switch (_dir) {
+                case std::ios_base::beg:
+                    new_position = _offset;
+                    break;
+
+                case std::ios_base::cur:
+                    new_position = position_ + _offset;
+                    break;
+
+                case std::ios_base::end: {
+                    // Only the server knows where the data object ends.
+                    auto& s = *streams_.front();
+                    const auto pos = s.transport.seekpos(_offset, _dir);
+
+                    if (seek_error == pos) {
+                        s.position = unknown_position;
+                        return seek_error;
+                    }
+
+                    new_position = s.position = pos;
+                    break;
+                }
+
+                default:
+                    return seek_error;
+            }
+
+            if (new_position < 0) {
+                return seek_error;
+            }
+
+            position_ = new_position;
+
+            return position_;
+        }
+
+        bool is_open() const noexcept override
+        {
+            return !streams_.empty() && streams_.front()->transport.is_open();
+        }
+
+        int file_descriptor() const noexcept override
+        {
+            return !streams_.empty()
+                ? streams_.front()->transport.file_descriptor()
+                : uninitialized_file_descriptor;
+        }
+
+        // Returns the number of connections the data object is open on. This
+        // is always one when the data object is open for writing.
+        int stream_count() const noexcept
+        {
+            return static_cast<int>(streams_.size());
+        }
+
+    private:
+        struct stream
+        {
+            explicit stream(irods::connection_pool::connection_proxy&& _conn)
+                : conn{std::move(_conn)}
+                , transport{conn}
+                , position{}
+            {
+            }
+
+            irods::connection_pool::connection_proxy conn;
+            basic_transport<CharT> transport;
+            off_type position;  // Where the descriptor points, as far as we know.
+        };
+
+        bool open_impl(const irods::experimental::filesystem::path& _p,
+                       std::ios_base::openmode _mode,
+                       std::optional<int> _replica_number,
+                       const std::string* _resource_name)
+        {
+            using std::ios_base;
+
+            if (is_open() || (_mode & ios_base::app)) {
+                return false;
+            }
+
+            streams_.clear();
+
+            auto& primary = *streams_.emplace_back(std::make_unique<stream>(pool_->get_connection()));
+
+            const bool striped = !(_mode & ios_base::out) && options_.streams > 1;
+
+            // Without a replica number, each open could pick a different
+            // replica, so one is chosen up front for all of them.
+            if (striped && !_replica_number) {
+                _replica_number = find_good_replica(primary.conn, _p, _resource_name);
+            }
+
+            const auto open_stream = [&](auto& _tp, auto _m) {
+                if (_replica_number) {
+                    return _tp.open(_p, *_replica_number, _m);
+                }
+
+                if (_resource_name) {
+                    return _tp.open(_p, *_resource_name, _m);
+                }
+
+                return _tp.open(_p, _m);
+            };
+
+            // Positioning at the end is handled below so that the position
+            // is known.
+            if (!open_stream(primary.transport, _mode & ~ios_base::ate)) {
+                streams_.clear();
+                return false;
+            }
+
+            // Never wait for additional connections. Waiting could deadlock
+            // if several striped transports share a small pool.
+            while (striped && _replica_number && static_cast<int>(streams_.size()) < options_.streams) {
+                auto conn = pool_->try_get_connection();
+
+                if (!conn) {
+                    break;
+                }
+
+                auto s = std::make_unique<stream>(std::move(*conn));
+
+                if (!open_stream(s->transport, ios_base::in)) {
+                    break;
+                }
+
+                streams_.push_back(std::move(s));
+            }
+
+            if (streams_.size() > 1) {
+                workers_ = std::make_unique<irods::thread_pool>(static_cast<int>(streams_.size()) - 1);
+            }
+
+            position_ = 0;
+
+            if ((_mode & ios_base::ate) && seekpos(0, ios_base::end) == seek_error) {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        // Returns the number of a good replica of "_p", or nothing if there is
+        // none (e.g. the data object does not exist).
+        static std::optional<int> find_good_replica(rcComm_t& _comm,
+                                                    const irods::experimental::filesystem::path& _p,
+                                                    const std::string* _resource_name)
+        {
+            std::string q = "select DATA_REPL_NUM where COLL_NAME = '";
+            q += _p.parent_path().string();
+            q += "' and DATA_NAME = '";
+            q += _p.object_name().string();
+            q += "' and DATA_REPL_STATUS = '1'";
+
+            if (_resource_name) {
+                q += " and DATA_RESC_HIER = '" + *_resource_name + "' || like '" + *_resource_name + ";%'";
+            }
+
+            for (auto&& row : irods::query<rcComm_t>{&_comm, q}) {
+                return std::stoi(std::string{row[0]});
+            }
+
+            return std::nullopt;
+        }
+
+        // Moves "_size" characters between "_buffer" and the data object,
+        // starting at the current position. Returns the number of characters
+        // transferred before the first short or failed range, or the error of
+        // the first range if nothing was transferred.
+        template <typename Pointer, typename Function>
+        std::streamsize transfer(Pointer _buffer, std::streamsize _size, Function _func)
+        {
+            if (!is_open()) {
+                return seek_failed;
+            }
+
+            if (_size <= 0) {
+                return 0;
+            }
+
+            const auto stripe = static_cast<std::streamsize>(options_.stripe_size);
+            const auto range_count = static_cast<std::size_t>((_size + stripe - 1) / stripe);
+            const auto stream_count = std::min(streams_.size(), range_count);
+
+            std::vector<std::streamsize> results(range_count);
+
+            // Stream "s" serves ranges s, s + stream_count, s + 2 * stream_count, ...
+            const auto run = [&](std::size_t _s) {
+                for (auto r = _s; r < range_count; r += stream_count) {
+                    const auto offset = static_cast<std::streamsize>(r) * stripe;
+                    const auto length = std::min(stripe, _size - offset);
+
+                    results[r] = transfer_range(*streams_[_s], position_ + offset, _buffer + offset, length, _func);
+
+                    if (results[r] != length) {
+                        break;
+                    }
+                }
+            };
+
+            std::vector<std::future<void>> pending;
+            pending.reserve(stream_count - 1);
+
+            for (std::size_t s = 1; s < stream_count; ++s) {
+                std::promise<void> p;
+                pending.push_back(p.get_future());
+
+                irods::thread_pool::post(*workers_, [&run, s, p = std::move(p)]() mutable {
+                    run(s);
+                    p.set_value();
+                });
+            }
+
+            run(0);
+
+            for (auto& f : pending) {
+                f.wait();
+            }
+
+            std::streamsize total = 0;
+
+            for (std::size_t r = 0; r < range_count; ++r) {
+                const auto length = std::min(stripe, _size - static_cast<std::streamsize>(r) * stripe);
+
+                if (results[r] < 0) {
+                    if (total == 0) {
+                        return results[r];
+                    }
+
+                    break;
+                }
+
+                total += results[r];
+
+                if (results[r] != length) {
+                    break;
+                }
+            }
+
+            position_ += total;
+
+            return total;
+        }
+
+        template <typename Pointer, typename Function>
+        static std::streamsize transfer_range(stream& _s,
+                                              off_type _offset,
+                                              Pointer _buffer,
+                                              std::streamsize _length,
+                                              Function& _func)
+        {
+            if (_s.position != _offset) {
+                if (seek_error == _s.transport.seekpos(_offset, std::ios_base::beg)) {
+                    _s.position = unknown_position;
+                    return seek_failed;
+                }
+
+                _s.position = _offset;
+            }
+
+            const auto n = _func(_s.transport, _buffer, _length);
+            _s.position = n >= 0 ? _s.position + n : unknown_position;
+
+            return n;
+        }
+
+        irods::connection_pool* pool_;
+        striped_transport_options options_;
+        std::vector<std::unique_ptr<stream>> streams_;
+        std::unique_ptr<irods::thread_pool> workers_;
+        off_type position_;
+    }; // basic_striped_transport
+
+    using striped_transport = basic_striped_transport<char>;
+} // irods::experimental::io::client
+
+#endif // IRODS_IO_STRIPED_TRANSPORT_HPP
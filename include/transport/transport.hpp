@@ -42,6 +42,28 @@ namespace irods::experimental::io
 
         virtual pos_type seekpos(off_type _offset, std::ios_base::seekdir _dir) = 0;
 
+        // Positional variants of receive() and send(). They transfer data
+        // starting at "_offset" and leave the position just past the last
+        // character transferred. Implementations should avoid repositioning
+        // when the position is already "_offset".
+        virtual std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _buffer_size)
+        {
+            if (seekpos(_offset, std::ios_base::beg) == pos_type{off_type{-1}}) {
+                return -1;
+            }
+
+            return receive(_buffer, _buffer_size);
+        }
+
+        virtual std::streamsize send_at(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size)
+        {
+            if (seekpos(_offset, std::ios_base::beg) == pos_type{off_type{-1}}) {
+                return -1;
+            }
+
+            return send(_buffer, _buffer_size);
+        }
+
         virtual bool is_open() const noexcept = 0;
 
         virtual int file_descriptor() const noexcept = 0;
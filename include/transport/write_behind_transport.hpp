@@ -0,0 +1,312 @@
+#ifndef IRODS_IO_WRITE_BEHIND_TRANSPORT_HPP
+#define IRODS_IO_WRITE_BEHIND_TRANSPORT_HPP
+
+#include "buffer_pool.hpp"
+#include "transport/transport.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace irods::experimental::io
+{
+    // A transport that sends data on a background thread. It wraps another
+    // transport (e.g. client::default_transport), which it does not own.
+    //
+    //     client::default_transport tp{conn};
+    //     write_behind_transport wb{tp};
+    //     odstream out{wb, "/tempZone/home/rods/foo"};
+    //
+    // send() copies the caller's data into a queue holding at most
+    // "_max_queued_buffers" buffers and returns immediately unless the queue
+    // is full. The buffers are sent in order over the wrapped transport.
+    //
+    // A failed write is reported by the next call to send(), flush(),
+    // receive(), seekpos() or close(). Once a write fails, queued data is
+    // dropped and every later write fails until the transport is reopened.
+    //
+    // receive(), seekpos() and close() wait for all queued data to be sent
+    // first, so the data object is never read, repositioned or closed ahead
+    // of a write accepted before it.
+    template <typename CharT>
+    class basic_write_behind_transport : public transport<CharT>
+    {
+    public:
+        // clang-format off
+        using char_type   = typename transport<CharT>::char_type;
+        using traits_type = typename transport<CharT>::traits_type;
+        using int_type    = typename traits_type::int_type;
+        using pos_type    = typename traits_type::pos_type;
+        using off_type    = typename traits_type::off_type;
+        // clang-format on
+
+    private:
+        // clang-format off
+        inline static constexpr auto            current_position  = off_type{-1};
+        inline static constexpr std::streamsize short_write_error = -1;
+        inline static const     auto            seek_error        = pos_type{off_type{-1}};
+        // clang-format on
+
+    public:
+        explicit basic_write_behind_transport(transport<CharT>& _transport, int _max_queued_buffers = 4)
+            : transport<CharT>{}
+            , transport_{&_transport}
+            , max_queued_buffers_{std::max(_max_queued_buffers, 1)}
+            , mutex_{}
+            , queue_changed_{}
+            , queue_{}
+            , sending_{}
+            , stop_{}
+            , error_{}
+            , sender_{}
+        {
+        }
+
+        basic_write_behind_transport(const basic_write_behind_transport&) = delete;
+        basic_write_behind_transport& operator=(const basic_write_behind_transport&) = delete;
+
+        ~basic_write_behind_transport()
+        {
+            stop_sending();
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  std::ios_base::openmode _mode) override
+        {
+            if (is_open()) {
+                return false;
+            }
+
+            reset();
+
+            return transport_->open(_p, _mode);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  int _replica_number,
+                  std::ios_base::openmode _mode) override
+        {
+            if (is_open()) {
+                return false;
+            }
+
+            reset();
+
+            return transport_->open(_p, _replica_number, _mode);
+        }
+
+        bool open(const irods::experimental::filesystem::path& _p,
+                  const std::string& _resource_name,
+                  std::ios_base::openmode _mode) override
+        {
+            if (is_open()) {
+                return false;
+            }
+
+            reset();
+
+            return transport_->open(_p, _resource_name, _mode);
+        }
+
+        // Sends all queued data before closing the wrapped transport. Returns
+        // false if any write failed, even though the data object is closed.
+        bool close() override
+        {
+            const auto flushed = flush();
+            stop_sending();
+
+            const auto closed = transport_->close();
+
+            reset();
+
+            return flushed && closed;
+        }
+
+        std::streamsize receive(char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (!flush()) {
+                return error();
+            }
+
+            return transport_->receive(_buffer, _buffer_size);
+        }
+
+        std::streamsize send(const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            return enqueue(current_position, _buffer, _buffer_size);
+        }
+
+        // Queued like send(), so the write still happens in order with the
+        // writes around it.
+        std::streamsize send_at(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            return _offset < 0 ? short_write_error : enqueue(_offset, _buffer, _buffer_size);
+        }
+
+        std::streamsize receive_at(off_type _offset, char_type* _buffer, std::streamsize _buffer_size) override
+        {
+            if (!flush()) {
+                return error();
+            }
+
+            return transport_->receive_at(_offset, _buffer, _buffer_size);
+        }
+
+        pos_type seekpos(off_type _offset, std::ios_base::seekdir _dir) override
+        {
+            if (!flush()) {
+                return seek_error;
+            }
+
+            return transport_->seekpos(_offset, _dir);
+        }
+
+        bool is_open() const noexcept override
+        {
+            return transport_->is_open();
+        }
+
+        int file_descriptor() const noexcept override
+        {
+            return transport_->file_descriptor();
+        }
+
+        // Waits until all queued data has been sent. Returns false if any
+        // write failed.
+        bool flush()
+        {
+            std::unique_lock lk{mutex_};
+            queue_changed_.wait(lk, [this] { return error_ != 0 || (queue_.empty() && !sending_); });
+            return error_ == 0;
+        }
+
+        // Returns the error code of the first failed write, or zero.
+        std::streamsize error() const
+        {
+            std::lock_guard lk{mutex_};
+            return error_;
+        }
+
+    private:
+        struct queued_buffer
+        {
+            off_type offset;  // Where to write, or current_position.
+            buffer_pool::buffer buffer;
+            std::size_t size;
+        };
+
+        std::streamsize enqueue(off_type _offset, const char_type* _buffer, std::streamsize _buffer_size)
+        {
+            if (_buffer_size <= 0) {
+                return 0;
+            }
+
+            const auto size = static_cast<std::size_t>(_buffer_size) * sizeof(char_type);
+
+            // Copy the data before taking the lock so that the sender is not
+            // held up by the caller.
+            auto buffer = buffer_pool::instance().acquire(size);
+            std::memcpy(buffer.data(), _buffer, size);
+
+            std::unique_lock lk{mutex_};
+
+            queue_changed_.wait(lk, [this] {
+                return error_ != 0 || static_cast<int>(queue_.size()) < max_queued_buffers_;
+            });
+
+            if (error_ != 0) {
+                return error_;
+            }
+
+            if (!sender_.joinable()) {
+                stop_ = false;
+                sender_ = std::thread{[this] { send_queued_buffers(); }};
+            }
+
+            queue_.push_back({_offset, std::move(buffer), size});
+            lk.unlock();
+
+            queue_changed_.notify_all();
+
+            return _buffer_size;
+        }
+
+        void send_queued_buffers()
+        {
+            std::unique_lock lk{mutex_};
+
+            while (true) {
+                queue_changed_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+
+                if (queue_.empty()) {
+                    return;
+                }
+
+                auto qb = std::move(queue_.front());
+                queue_.pop_front();
+                sending_ = true;
+                lk.unlock();
+
+                const auto count = static_cast<std::streamsize>(qb.size / sizeof(char_type));
+                const auto* p = reinterpret_cast<const char_type*>(qb.buffer.data());
+                const auto bytes_written = (current_position == qb.offset)
+                    ? transport_->send(p, count)
+                    : transport_->send_at(qb.offset, p, count);
+
+                lk.lock();
+                sending_ = false;
+
+                if (bytes_written != count) {
+                    error_ = bytes_written < 0 ? bytes_written : short_write_error;
+                    queue_.clear();
+                }
+
+                queue_changed_.notify_all();
+            }
+        }
+
+        void stop_sending()
+        {
+            if (!sender_.joinable()) {
+                return;
+            }
+
+            {
+                std::lock_guard lk{mutex_};
+                stop_ = true;
+            }
+
+            queue_changed_.notify_all();
+            sender_.join();
+        }
+
+        // Clears the state left behind by a previously opened data object.
+        void reset()
+        {
+            stop_sending();
+
+            std::lock_guard lk{mutex_};
+            queue_.clear();
+            error_ = 0;
+        }
+
+        transport<CharT>* transport_;
+        const int max_queued_buffers_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable queue_changed_;
+        std::deque<queued_buffer> queue_;
+        bool sending_;
+        bool stop_;
+        std::streamsize error_;
+        std::thread sender_;
+    }; // basic_write_behind_transport
+
+    using write_behind_transport = basic_write_behind_transport<char>;
+} // irods::experimental::io
+
+#endif // IRODS_IO_WRITE_BEHIND_TRANSPORT_HPP
@@ -0,0 +1,413 @@
+#ifndef IRODS_TYPED_QUERY_HPP
+#define IRODS_TYPED_QUERY_HPP
+
+#include "query.hpp"
+#include "irods_exception.hpp"
+#include "irods_at_scope_exit.hpp"
+#include "rcMisc.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace irods::experimental::genquery
+{
+    // Columns whose values are converted to std::int64_t. All other columns
+    // are returned as std::string_view.
+    constexpr bool is_integer_column(int _column_id) noexcept
+    {
+        // clang-format off
+        switch (_column_id) {
+            case COL_USER_ID:
+            case COL_R_RESC_ID:
+            case COL_D_DATA_ID:
+            case COL_D_COLL_ID:
+            case COL_DATA_REPL_NUM:
+            case COL_DATA_SIZE:
+            case COL_D_REPL_STATUS:
+            case COL_D_CREATE_TIME:
+            case COL_D_MODIFY_TIME:
+            case COL_D_RESC_ID:
+            case COL_COLL_ID:
+            case COL_COLL_CREATE_TIME:
+            case COL_COLL_MODIFY_TIME:
+            case COL_META_DATA_ATTR_ID:
+                return true;
+
+            default:
+                return false;
+        }
+        // clang-format on
+    }
+
+    // Maps a column id to the type its values are converted to. May be
+    // specialized for columns not covered by is_integer_column().
+    template <int ColumnId>
+    struct column_traits
+    {
+        using value_type = std::conditional_t<is_integer_column(ColumnId), std::int64_t, std::string_view>;
+    };
+
+    struct condition
+    {
+        int column_id;
+        std::string value;
+    };
+
+    // A column used on the left-hand side of a condition.
+    //
+    //     col<COL_COLL_NAME> == "/tempZone/home/rods"
+    //
+    // The column ids are plain integer macros, so they cannot carry
+    // operators themselves.
+    template <int ColumnId>
+    struct column
+    {
+        static constexpr int id = ColumnId;
+    };
+
+    template <int ColumnId>
+    inline constexpr column<ColumnId> col{};
+
+    namespace detail
+    {
+        inline std::string quote(std::string_view _op, std::string_view _value)
+        {
+            std::string s;
+            s.reserve(_op.size() + _value.size() + 3);
+            s += _op;
+            s += " '";
+            s += _value;
+            s += '\'';
+            return s;
+        }
+
+        template <typename T>
+        std::string to_condition_value(const T& _value)
+        {
+            if constexpr (std::is_arithmetic_v<T>) {
+                return std::to_string(_value);
+            }
+            else {
+                return std::string{_value};
+            }
+        }
+
+        inline std::int64_t to_integer(std::string_view _value)
+        {
+            // GenQuery returns an empty string for NULL values.
+            if (_value.empty()) {
+                return 0;
+            }
+
+            // Values in a page are null-terminated.
+            char* end{};
+            errno = 0;
+            const auto n = std::strtoll(_value.data(), &end, 10);
+
+            if (errno != 0 || end != _value.data() + _value.size()) {
+                THROW(SYS_INTERNAL_ERR, "cannot convert query result to integer");
+            }
+
+            return n;
+        }
+
+        template <typename T>
+        T convert(std::string_view _value)
+        {
+            if constexpr (std::is_same_v<T, std::int64_t>) {
+                return to_integer(_value);
+            }
+            else {
+                return T{_value};
+            }
+        }
+    } // namespace detail
+
+    // clang-format off
+    template <int ColumnId, typename T>
+    condition operator==(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote("=", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId, typename T>
+    condition operator!=(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote("<>", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId, typename T>
+    condition operator<(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote("<", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId, typename T>
+    condition operator<=(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote("<=", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId, typename T>
+    condition operator>(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote(">", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId, typename T>
+    condition operator>=(column<ColumnId>, const T& _value) { return {ColumnId, detail::quote(">=", detail::to_condition_value(_value))}; }
+
+    template <int ColumnId>
+    condition like(column<ColumnId>, std::string_view _pattern) { return {ColumnId, detail::quote("like", _pattern)}; }
+
+    template <int ColumnId>
+    condition not_like(column<ColumnId>, std::string_view _pattern) { return {ColumnId, detail::quote("not like", _pattern)}; }
+    // clang-format on
+
+    template <int ColumnId>
+    condition in(column<ColumnId>, std::initializer_list<std::string_view> _values)
+    {
+        std::string s{"in ("};
+
+        for (auto v = std::begin(_values); v != std::end(_values); ++v) {
+            if (v != std::begin(_values)) {
+                s += ", ";
+            }
+
+            s += '\'';
+            s += *v;
+            s += '\'';
+        }
+
+        s += ')';
+
+        return {ColumnId, std::move(s)};
+    }
+
+    // Matches rows satisfying either condition. Both conditions must be on
+    // the same column.
+    //
+    //     col<COL_COLL_NAME> == "/tempZone/a" || like(col<COL_COLL_NAME>, "/tempZone/a/%")
+    inline condition operator||(condition _lhs, const condition& _rhs)
+    {
+        if (_lhs.column_id != _rhs.column_id) {
+            THROW(SYS_INVALID_INPUT_PARAM, "conditions joined with || must be on the same column");
+        }
+
+        _lhs.value += " || ";
+        _lhs.value += _rhs.value;
+
+        return _lhs;
+    }
+
+    // A general query whose columns are known at compile time. The query
+    // input is built directly from the column ids, so no query string is
+    // parsed, and each row is converted to a tuple once, with integer columns
+    // already parsed.
+    //
+    //     namespace gq = irods::experimental::genquery;
+    //
+    //     auto q = gq::select<COL_DATA_NAME, COL_DATA_SIZE>()
+    //                 .where(gq::col<COL_COLL_NAME> == "/tempZone/home/rods");
+    //
+    //     q.execute(&comm, [](const auto& row) {
+    //         const auto& [name, size] = row; // std::string_view, std::int64_t
+    //     });
+    //
+    // String values in a row point into the current page of results and are
+    // only valid inside the callback.
+    template <int... ColumnIds>
+    class select_query
+    {
+    public:
+        static_assert(sizeof...(ColumnIds) > 0, "at least one column must be selected");
+
+        using row_type = std::tuple<typename column_traits<ColumnIds>::value_type...>;
+
+        select_query() = default;
+
+        select_query& where(condition _cond) &
+        {
+            conditions_.push_back(std::move(_cond));
+            return *this;
+        }
+
+        select_query&& where(condition _cond) &&
+        {
+            conditions_.push_back(std::move(_cond));
+            return std::move(*this);
+        }
+
+        select_query& no_distinct() &
+        {
+            options_ |= NO_DISTINCT;
+            return *this;
+        }
+
+        select_query&& no_distinct() &&
+        {
+            options_ |= NO_DISTINCT;
+            return std::move(*this);
+        }
+
+        // Fills "_input" with the selected columns and conditions. The caller
+        // must release it with clearGenQueryInp().
+        void build(genQueryInp_t& _input) const
+        {
+            _input.options = options_;
+
+            (addInxIval(&_input.selectInp, ColumnIds, 1), ...);
+
+            for (const auto& c : conditions_) {
+                addInxVal(&_input.sqlCondInp, c.column_id, c.value.c_str());
+            }
+        }
+
+        // Invokes "_func" with a const row_type& for each row.
+        template <typename connection_type, typename Function>
+        void execute(connection_type* _comm,
+                     Function _func,
+                     uintmax_t _query_limit = 0,
+                     const query_options& _options = {}) const
+        {
+            execute_pages(_comm, [&_func](const std::vector<row_type>& _rows) {
+                for (const auto& row : _rows) {
+                    _func(row);
+                }
+            }, _query_limit, _options);
+        }
+
+        // Invokes "_func" with a const std::vector<row_type>& holding every
+        // row of a page.
+        template <typename connection_type, typename Function>
+        void execute_pages(connection_type* _comm,
+                           Function _func,
+                           uintmax_t _query_limit = 0,
+                           const query_options& _options = {}) const
+        {
+            genQueryInp_t input{};
+            irods::at_scope_exit<std::function<void()>> free_input{[&input] { clearGenQueryInp(&input); }};
+
+            build(input);
+
+            query<connection_type> q{_comm, input, _query_limit, _options};
+            std::vector<row_type> rows;
+
+            q.for_each_page([&](const typename query<connection_type>::page_view& _page) {
+                rows.clear();
+                rows.reserve(_page.size());
+
+                for (std::size_t i = 0; i < _page.size(); ++i) {
+                    rows.push_back(make_row(_page[i], std::index_sequence_for<std::integral_constant<int, ColumnIds>...>{}));
+                }
+
+                _func(static_cast<const std::vector<row_type>&>(rows));
+            });
+        }
+
+    private:
+        template <typename RowView, std::size_t... Is>
+        static row_type make_row(const RowView& _row, std::index_sequence<Is...>)
+        {
+            return row_type{detail::convert<std::tuple_element_t<Is, row_type>>(_row[Is])...};
+        }
+
+        std::vector<condition> conditions_;
+        int options_ = 0;
+    }; // class select_query
+
+    template <int... ColumnIds>
+    select_query<ColumnIds...> select()
+    {
+        return {};
+    }
+
+    // An aggregate function applied to a column.
+    struct aggregate
+    {
+        int column_id;
+        int function;
+    };
+
+    // clang-format off
+    template <int ColumnId> aggregate count(column<ColumnId>) { return {ColumnId, SELECT_COUNT}; }
+    template <int ColumnId> aggregate sum(column<ColumnId>)   { return {ColumnId, SELECT_SUM}; }
+    template <int ColumnId> aggregate min(column<ColumnId>)   { return {ColumnId, SELECT_MIN}; }
+    template <int ColumnId> aggregate max(column<ColumnId>)   { return {ColumnId, SELECT_MAX}; }
+    // clang-format on
+
+    namespace detail
+    {
+        // Runs a query expected to produce at most one row. The server is
+        // asked to close the statement after the first row, so the query
+        // never needs a second round trip. Returns false if there is no row.
+        template <typename connection_type, typename Function>
+        bool run_single_row_query(connection_type* _comm, genQueryInp_t& _input, Function _func)
+        {
+            irods::at_scope_exit<std::function<void()>> free_input{[&_input] { clearGenQueryInp(&_input); }};
+
+            _input.options |= AUTO_CLOSE;
+
+            query_options opts;
+            opts.page_size = 1;
+
+            for (auto&& row : query<connection_type>{_comm, _input, 1, opts}) {
+                _func(row);
+                return true;
+            }
+
+            return false;
+        }
+    } // namespace detail
+
+    // Computes every aggregate over the rows matching the conditions in a
+    // single round trip. Results are returned in the order requested, with
+    // aggregates over no rows reported as zero.
+    //
+    //     const auto totals = aggregate_query(&comm,
+    //                                         {count(col<COL_D_DATA_ID>), sum(col<COL_DATA_SIZE>)},
+    //                                         {col<COL_COLL_NAME> == "/tempZone/home/rods"});
+    //
+    // All aggregates are computed over the same joined rows. Mixing data
+    // object and collection columns therefore only counts collections that
+    // contain data objects, so use separate calls for those.
+    template <typename connection_type>
+    std::vector<std::int64_t> aggregate_query(connection_type* _comm,
+                                              std::initializer_list<aggregate> _aggregates,
+                                              std::initializer_list<condition> _conditions = {})
+    {
+        genQueryInp_t input{};
+
+        for (const auto& a : _aggregates) {
+            addInxIval(&input.selectInp, a.column_id, a.function);
+        }
+
+        for (const auto& c : _conditions) {
+            addInxVal(&input.sqlCondInp, c.column_id, c.value.c_str());
+        }
+
+        std::vector<std::int64_t> results(_aggregates.size());
+
+        detail::run_single_row_query(_comm, input, [&results](const auto& _row) {
+            for (std::size_t i = 0; i < results.size(); ++i) {
+                results[i] = detail::to_integer(_row[i]);
+            }
+        });
+
+        return results;
+    }
+
+    // Returns whether any row matches the conditions. At most one row is
+    // fetched, in a single round trip.
+    template <typename connection_type, int ColumnId>
+    bool has_rows(connection_type* _comm,
+                  column<ColumnId>,
+                  std::initializer_list<condition> _conditions = {})
+    {
+        genQueryInp_t input{};
+
+        addInxIval(&input.selectInp, ColumnId, 1);
+
+        for (const auto& c : _conditions) {
+            addInxVal(&input.sqlCondInp, c.column_id, c.value.c_str());
+        }
+
+        return detail::run_single_row_query(_comm, input, [](const auto&) {});
+    }
+} // namespace irods::experimental::genquery
+
+#endif // IRODS_TYPED_QUERY_HPP
@@ -12,10 +12,12 @@
 
 typedef struct {
     int columnId;
-    char *columnName;
+    const char *columnName;
 } columnName_t;
 
-columnName_t columnNames[] = {
+/* constexpr so that the lookup tables in rcMisc.cpp are built at compile
+ * time. */
+constexpr columnName_t columnNames[] = {
     { COL_ZONE_ID,          "ZONE_ID", },
     { COL_ZONE_NAME,        "ZONE_NAME", },
 
@@ -377,6 +379,6 @@ columnName_t columnNames[] = {
 
 };
 
-int NumOfColumnNames = sizeof( columnNames ) / sizeof( columnName_t );
+constexpr int NumOfColumnNames = sizeof( columnNames ) / sizeof( columnName_t );
 
 #endif	/* GEN_QUERY_NAMES_H__ */
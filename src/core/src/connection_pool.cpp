@@ -3,17 +3,34 @@
 #include "query.hpp"
 #include "thread_pool.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 #include <thread>
 
 namespace irods {
 
+namespace {
+
+// The connection most recently checked out by the current thread. The pool
+// id guards against using an index from a different pool.
+struct affinity_entry
+{
+    std::uint64_t pool_id;
+    int index;
+};
+
+thread_local affinity_entry last_connection{0, -1};
+
+std::atomic<std::uint64_t> next_pool_id{1};
+
+} // anonymous namespace
+
 constexpr int connection_pool::connection_proxy::uninitialized_index;
 
 connection_pool::connection_proxy::~connection_proxy()
 {
     if (pool_ && conn_ && uninitialized_index != index_) {
-        pool_->return_connection(index_);
+        pool_->release_connection(index_, checkout_time_);
     }
 }
 
@@ -21,6 +38,8 @@ connection_pool::connection_proxy::connection_proxy(connection_proxy&& _other)
     : pool_{_other.pool_}
     , conn_{_other.conn_}
     , index_{_other.index_}
+    , wait_time_{_other.wait_time_}
+    , checkout_time_{_other.checkout_time_}
 {
     _other.pool_ = nullptr;
     _other.conn_ = nullptr;
@@ -29,9 +48,17 @@ connection_pool::connection_proxy::connection_proxy(connection_proxy&& _other)
 
 connection_pool::connection_proxy& connection_pool::connection_proxy::operator=(connection_proxy&& _other)
 {
+    // Return the currently held connection before taking ownership of
+    // the other one. Dropping it silently would leave it marked as in use.
+    if (pool_ && conn_ && uninitialized_index != index_) {
+        pool_->release_connection(index_, checkout_time_);
+    }
+
     pool_ = _other.pool_;
     conn_ = _other.conn_;
     index_ = _other.index_;
+    wait_time_ = _other.wait_time_;
+    checkout_time_ = _other.checkout_time_;
 
     _other.pool_ = nullptr;
     _other.conn_ = nullptr;
@@ -45,12 +72,27 @@ connection_pool::connection_proxy::operator rcComm_t&() const noexcept
     return *conn_;
 }
 
+connection_pool::clock_type::duration connection_pool::connection_proxy::wait_time() const noexcept
+{
+    return wait_time_;
+}
+
+void connection_pool::connection_proxy::report_socket_error() noexcept
+{
+    if (pool_ && uninitialized_index != index_) {
+        pool_->conn_ctxs_[index_].socket_error = true;
+    }
+}
+
 connection_pool::connection_proxy::connection_proxy(connection_pool& _pool,
                                                     rcComm_t& _conn,
-                                                    int _index) noexcept
+                                                    int _index,
+                                                    clock_type::duration _wait_time) noexcept
     : pool_{&_pool}
     , conn_{&_conn}
     , index_{_index}
+    , wait_time_{_wait_time}
+    , checkout_time_{clock_type::now()}
 {
 }
 
@@ -60,17 +102,48 @@ connection_pool::connection_pool(int _size,
                                  const std::string& _username,
                                  const std::string& _zone,
                                  const int _refresh_time)
+    : connection_pool{_size, _host, _port, _username, _zone, _refresh_time, connection_pool_options{}}
+{
+}
+
+connection_pool::connection_pool(int _size,
+                                 const std::string& _host,
+                                 const int _port,
+                                 const std::string& _username,
+                                 const std::string& _zone,
+                                 const int _refresh_time,
+                                 const connection_pool_options& _options)
     : host_{_host}
     , port_{_port}
     , username_{_username}
     , zone_{_zone}
     , refresh_time_(_refresh_time)
-    , conn_ctxs_(_size)
+    , options_{_options}
+    , id_{next_pool_id++}
+    , conn_ctxs_(std::max(_size, _options.max_size))
+    , min_size_{_size}
+    , waiters_mutex_{}
+    , waiters_{}
+    , waiter_count_{}
+    , live_count_{_size}
+    , pending_count_{}
+    , growth_pool_{}
+    , maintenance_mutex_{}
+    , maintenance_cv_{}
+    , stop_maintenance_{}
+    , maintenance_thread_{}
 {
-    if (_size < 1) {
+    if (_size < 1 || (_options.max_size != 0 && _options.max_size < _size)) {
         throw std::runtime_error{"invalid connection pool size"};
     }
 
+    // Slots above the minimum size start out vacant. Vacant slots are
+    // marked as in use so that they are never handed out.
+    for (auto i = _size; i < static_cast<int>(conn_ctxs_.size()); ++i) {
+        conn_ctxs_[i].in_use.store(true);
+        conn_ctxs_[i].vacant = true;
+    }
+
     // Always initialize the first connection to guarantee that the
     // network plugin is loaded. This guarantees that asynchronous calls
     // to rcConnect do not cause a segfault.
@@ -78,38 +151,61 @@ connection_pool::connection_pool(int _size,
                       [] { throw std::runtime_error{"connect error"}; },
                       [] { throw std::runtime_error{"client login error"}; });
 
-    // If the size of the pool is one, then return immediately.
-    if (_size == 1) {
-        return;
-    }
-
     // Initialize the rest of the connection pool asynchronously.
+    if (_size > 1) {
+        irods::thread_pool thread_pool{std::min<int>(_size, std::thread::hardware_concurrency())};
+
+        std::atomic<bool> connect_error{};
+        std::atomic<bool> login_error{};
+
+        for (int i = 1; i < _size; ++i) {
+            irods::thread_pool::post(thread_pool, [this, i, &connect_error, &login_error] {
+                if (connect_error.load() || login_error.load()) {
+                    return;
+                }
+
+                create_connection(i,
+                                  [&connect_error] { connect_error.store(true); },
+                                  [&login_error] { login_error.store(true); });
+            });
+        }
 
-    irods::thread_pool thread_pool{std::min<int>(_size, std::thread::hardware_concurrency())};
+        thread_pool.join();
 
-    std::atomic<bool> connect_error{};
-    std::atomic<bool> login_error{};
+        if (connect_error.load()) {
+            throw std::runtime_error{"connect error"};
+        }
 
-    for (int i = 1; i < _size; ++i) {
-        irods::thread_pool::post(thread_pool, [this, i, &connect_error, &login_error] {
-            if (connect_error.load() || login_error.load()) {
-                return;
-            }
+        if (login_error.load()) {
+            throw std::runtime_error{"client login error"};
+        }
+    }
 
-            create_connection(i,
-                              [&connect_error] { connect_error.store(true); },
-                              [&login_error] { login_error.store(true); });
-        });
+    if (elastic()) {
+        const auto growth = static_cast<int>(conn_ctxs_.size()) - _size;
+        growth_pool_ = std::make_unique<irods::thread_pool>(std::min<int>(growth, std::thread::hardware_concurrency()));
     }
 
-    thread_pool.join();
+    if (options_.background_health_check || elastic() || options_.metrics_callback) {
+        maintenance_thread_ = std::thread{[this] { run_maintenance(); }};
+    }
+}
 
-    if (connect_error.load()) {
-        throw std::runtime_error{"connect error"};
+connection_pool::~connection_pool()
+{
+    if (maintenance_thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{maintenance_mutex_};
+            stop_maintenance_ = true;
+        }
+
+        maintenance_cv_.notify_one();
+        maintenance_thread_.join();
     }
 
-    if (login_error.load()) {
-        throw std::runtime_error{"client login error"};
+    // Wait for connections that are still being created.
+    if (growth_pool_) {
+        growth_pool_->join();
     }
 }
 
@@ -119,6 +215,8 @@ void connection_pool::create_connection(int _index,
 {
     auto& ctx = conn_ctxs_[_index];
     ctx.creation_time = std::time(nullptr);
+    ctx.last_used_time = clock_type::now();
+    ctx.socket_error = false;
     ctx.conn.reset(rcConnect(host_.c_str(),
                              port_,
                              username_.c_str(),
@@ -127,11 +225,15 @@ void connection_pool::create_connection(int _index,
                              &ctx.error));
 
     if (!ctx.conn) {
+        ++counters_.connect_failures;
+
         _on_connect_error();
         return;
     }
 
     if (clientLogin(ctx.conn.get()) != 0) {
+        ++counters_.login_failures;
+
         _on_login_error();
     }
 }
@@ -146,25 +248,240 @@ bool connection_pool::verify_connection(int _index)
 
     try {
         query<rcComm_t>{ctx.conn.get(), "select ZONE_NAME where ZONE_TYPE = 'local'"};
-        if(std::time(nullptr) - ctx.creation_time > refresh_time_) {
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+
+    ctx.socket_error = false;
+
+    return true;
+}
+
+bool connection_pool::connection_expired(int _index) const noexcept
+{
+    return std::time(nullptr) - conn_ctxs_[_index].creation_time > refresh_time_;
+}
+
+bool connection_pool::connection_healthy(int _index)
+{
+    const auto& ctx = conn_ctxs_[_index];
+
+    if (!ctx.conn || connection_expired(_index)) {
+        return false;
+    }
+
+    // Only pay for a round trip when there is reason to doubt the connection.
+    if (ctx.socket_error || clock_type::now() - ctx.last_used_time >= options_.verify_after_idle) {
+        if (!verify_connection(_index)) {
             return false;
         }
+
+        conn_ctxs_[_index].last_used_time = clock_type::now();
     }
-    catch (const std::exception&) {
+
+    return true;
+}
+
+void connection_pool::run_maintenance()
+{
+    const auto maintain_connections = options_.background_health_check || elastic();
+    const auto& dump_metrics = options_.metrics_callback;
+
+    auto next_check = clock_type::now() + options_.health_check_interval;
+    auto next_dump = clock_type::now() + options_.metrics_interval;
+
+    std::unique_lock<std::mutex> lock{maintenance_mutex_};
+
+    while (true) {
+        auto deadline = maintain_connections ? next_check : next_dump;
+
+        if (maintain_connections && dump_metrics) {
+            deadline = std::min(next_check, next_dump);
+        }
+
+        if (maintenance_cv_.wait_until(lock, deadline, [this] { return stop_maintenance_; })) {
+            break;
+        }
+
+        lock.unlock();
+
+        const auto now = clock_type::now();
+
+        if (maintain_connections && now >= next_check) {
+            check_idle_connections();
+            next_check = clock_type::now() + options_.health_check_interval;
+        }
+
+        if (dump_metrics && now >= next_dump) {
+            dump_metrics(metrics());
+            next_dump = clock_type::now() + options_.metrics_interval;
+        }
+
+        lock.lock();
+    }
+}
+
+void connection_pool::check_idle_connections()
+{
+    for (int i = 0; i < static_cast<int>(conn_ctxs_.size()); ++i) {
+        // Claim the connection so that it cannot be checked out while it is
+        // being inspected. Connections in use are skipped.
+        if (!try_claim_connection(i)) {
+            continue;
+        }
+
+        if (reap_if_idle(i)) {
+            continue;
+        }
+
+        if (options_.background_health_check) {
+            try {
+                if (!connection_healthy(i)) {
+                    if (conn_ctxs_[i].conn && connection_expired(i)) {
+                        ++counters_.refresh_reconnects;
+                    }
+
+                    conn_ctxs_[i].error = {};
+                    create_connection(i, [] {}, [this, i] { conn_ctxs_[i].conn.reset(); });
+                }
+            }
+            catch (const std::exception&) {
+                // Leave the connection as is. It will be recreated on checkout.
+            }
+        }
+
+        return_connection(i);
+    }
+}
+
+bool connection_pool::elastic() const noexcept
+{
+    return static_cast<int>(conn_ctxs_.size()) > min_size_;
+}
+
+void connection_pool::grow_if_needed()
+{
+    // Must be called while holding "waiters_mutex_".
+
+    if (!elastic() || static_cast<int>(waiters_.size()) <= pending_count_) {
+        return;
+    }
+
+    const auto end = std::end(conn_ctxs_);
+    const auto iter = std::find_if(std::begin(conn_ctxs_), end, [](const auto& _ctx) { return _ctx.vacant; });
+
+    if (iter == end) {
+        return;
+    }
+
+    const auto index = static_cast<int>(std::distance(std::begin(conn_ctxs_), iter));
+
+    iter->vacant = false;
+    ++live_count_;
+    ++pending_count_;
+
+    irods::thread_pool::post(*growth_pool_, [this, index] {
+        bool failed = false;
+
+        conn_ctxs_[index].error = {};
+        create_connection(index, [&failed] { failed = true; }, [&failed] { failed = true; });
+
+        {
+            std::lock_guard<std::mutex> lock{waiters_mutex_};
+
+            --pending_count_;
+
+            if (failed) {
+                // Give the slot back. The slot is still marked as in use,
+                // so it cannot be handed out.
+                conn_ctxs_[index].conn.reset();
+                conn_ctxs_[index].vacant = true;
+                --live_count_;
+
+                // Tell the first waiter without a deadline about the failure
+                // so that it does not wait forever (e.g. while the server is
+                // down), then try again for the waiters behind it. Waiters
+                // with a deadline keep waiting for a connection to be
+                // returned until it passes.
+                const auto iter = std::find_if(std::begin(waiters_), std::end(waiters_), [](const waiter* _w) {
+                    return !_w->timed;
+                });
+
+                if (iter != std::end(waiters_)) {
+                    auto* w = *iter;
+                    waiters_.erase(iter);
+                    --waiter_count_;
+
+                    w->connect_failed = true;
+                    w->cv.notify_one();
+
+                    grow_if_needed();
+                }
+
+                return;
+            }
+        }
+
+        // Hands the new connection to a waiter or makes it available.
+        return_connection(index);
+    });
+}
+
+bool connection_pool::reap_if_idle(int _index)
+{
+    // Must be called while the connection is claimed.
+
+    if (!elastic() || clock_type::now() - conn_ctxs_[_index].last_used_time < options_.idle_timeout) {
         return false;
     }
 
+    {
+        std::lock_guard<std::mutex> lock{waiters_mutex_};
+
+        if (live_count_ <= min_size_) {
+            return false;
+        }
+
+        --live_count_;
+    }
+
+    conn_ctxs_[_index].conn.reset();
+
+    // The slot stays marked as in use for as long as it is vacant. It is
+    // only published as vacant once the old connection has been closed.
+    std::lock_guard<std::mutex> lock{waiters_mutex_};
+    conn_ctxs_[_index].vacant = true;
+
     return true;
 }
 
 rcComm_t* connection_pool::refresh_connection(int _index)
 {
-    conn_ctxs_[_index].error = {};
+    auto& ctx = conn_ctxs_[_index];
 
-    if (!verify_connection(_index)) {
+    ctx.error = {};
+
+    // In background mode, the health checker does the expensive work. Only
+    // replace connections that are known to be bad or too old.
+    const auto expired = connection_expired(_index);
+    const auto healthy = options_.background_health_check
+        ? ctx.conn && !ctx.socket_error && !expired
+        : !expired && verify_connection(_index);
+
+    if (!healthy) {
+        if (ctx.conn && expired) {
+            ++counters_.refresh_reconnects;
+        }
+
+        // On a login error, drop the unauthenticated connection so that the
+        // cheap check above does not treat it as healthy on the next checkout.
         create_connection(_index,
                           [] { throw std::runtime_error{"connect error"}; },
-                          [] { throw std::runtime_error{"client login error"}; });
+                          [&ctx] {
+                              ctx.conn.reset();
+                              throw std::runtime_error{"client login error"};
+                          });
     }
 
     return conn_ctxs_[_index].conn.get();
@@ -172,22 +489,219 @@ rcComm_t* connection_pool::refresh_connection(int _index)
 
 connection_pool::connection_proxy connection_pool::get_connection()
 {
-    for (int i = 0;; i = ++i % conn_ctxs_.size()) {
-        std::unique_lock<std::mutex> lock{conn_ctxs_[i].mutex, std::defer_lock};
+    const auto start = clock_type::now();
+    const auto index = acquire_connection(std::nullopt);
+    return make_connection_proxy(index, clock_type::now() - start);
+}
+
+std::optional<connection_pool::connection_proxy> connection_pool::get_connection(clock_type::duration _timeout)
+{
+    const auto start = clock_type::now();
+    const auto index = acquire_connection(start + _timeout);
 
-        if (lock.try_lock()) {
-            if (!conn_ctxs_[i].in_use.load()) {
-                conn_ctxs_[i].in_use.store(true);
-                return {*this, *refresh_connection(i), i};
+    if (connection_proxy::uninitialized_index == index) {
+        return std::nullopt;
+    }
+
+    return make_connection_proxy(index, clock_type::now() - start);
+}
+
+std::optional<connection_pool::connection_proxy> connection_pool::try_get_connection()
+{
+    // Never jump ahead of threads that are already waiting.
+    if (waiter_count_.load() > 0) {
+        return std::nullopt;
+    }
+
+    const auto index = acquire_idle_connection();
+
+    if (connection_proxy::uninitialized_index == index) {
+        return std::nullopt;
+    }
+
+    return make_connection_proxy(index, clock_type::duration::zero());
+}
+
+bool connection_pool::try_claim_connection(int _index) noexcept
+{
+    auto& in_use = conn_ctxs_[_index].in_use;
+
+    // Check before attempting the exchange so that busy connections are
+    // only read, which keeps their cache lines shared.
+    bool expected = false;
+    return !in_use.load(std::memory_order_relaxed) && in_use.compare_exchange_strong(expected, true);
+}
+
+int connection_pool::acquire_idle_connection() noexcept
+{
+    const auto size = static_cast<int>(conn_ctxs_.size());
+    int start = 0;
+
+    if (options_.thread_affinity) {
+        if (last_connection.pool_id == id_) {
+            if (try_claim_connection(last_connection.index)) {
+                return last_connection.index;
             }
+
+            start = last_connection.index;
+        }
+        else {
+            // Spread threads without history across the pool.
+            start = static_cast<int>(std::hash<std::thread::id>{}(std::this_thread::get_id()) % size);
+        }
+    }
+
+    for (int n = 0; n < size; ++n) {
+        const auto i = (start + n) % size;
+
+        if (try_claim_connection(i)) {
+            return i;
+        }
+    }
+
+    return connection_proxy::uninitialized_index;
+}
+
+int connection_pool::acquire_connection(const std::optional<clock_type::time_point>& _deadline)
+{
+    // Fast path. Only take an idle connection without locking when no other
+    // thread is queued, otherwise this thread would barge ahead of them.
+    if (waiter_count_.load() == 0) {
+        if (const auto i = acquire_idle_connection(); connection_proxy::uninitialized_index != i) {
+            return i;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock{waiters_mutex_};
+
+    // Scan again while holding the lock. return_connection() only marks a
+    // connection as idle while holding this lock, so a connection released
+    // after the fast path cannot be missed.
+    if (waiters_.empty()) {
+        if (const auto i = acquire_idle_connection(); connection_proxy::uninitialized_index != i) {
+            return i;
         }
     }
+
+    waiter w;
+    w.timed = _deadline.has_value();
+    waiters_.push_back(&w);
+    ++waiter_count_;
+
+    grow_if_needed();
+
+    const auto done = [&w] { return connection_proxy::uninitialized_index != w.index || w.connect_failed; };
+
+    if (!_deadline) {
+        w.cv.wait(lock, done);
+    }
+    else if (!w.cv.wait_until(lock, *_deadline, done)) {
+        // Timed out. The lock is held, so no connection can be handed to
+        // this waiter while it removes itself from the queue.
+        waiters_.erase(std::find(std::begin(waiters_), std::end(waiters_), &w));
+        --waiter_count_;
+    }
+
+    // On success or failure, "w" has already been removed from the queue.
+    if (w.connect_failed) {
+        throw std::runtime_error{"connect error"};
+    }
+
+    return w.index;
+}
+
+connection_pool::connection_proxy connection_pool::make_connection_proxy(int _index, clock_type::duration _wait_time)
+{
+    if (options_.thread_affinity) {
+        last_connection = {id_, _index};
+    }
+
+    ++counters_.checkouts;
+    record_duration(counters_.wait_time, _wait_time);
+
+    try {
+        return {*this, *refresh_connection(_index), _index, _wait_time};
+    }
+    catch (...) {
+        return_connection(_index);
+        throw;
+    }
+}
+
+connection_pool_metrics connection_pool::metrics() const
+{
+    connection_pool_metrics m;
+
+    for (std::size_t i = 0; i < m.wait_time.size(); ++i) {
+        m.wait_time[i] = counters_.wait_time[i].load(std::memory_order_relaxed);
+        m.hold_time[i] = counters_.hold_time[i].load(std::memory_order_relaxed);
+    }
+
+    m.checkouts = counters_.checkouts.load(std::memory_order_relaxed);
+    m.refresh_reconnects = counters_.refresh_reconnects.load(std::memory_order_relaxed);
+    m.connect_failures = counters_.connect_failures.load(std::memory_order_relaxed);
+    m.login_failures = counters_.login_failures.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock{waiters_mutex_};
+
+    for (const auto& ctx : conn_ctxs_) {
+        if (ctx.vacant) {
+            continue;
+        }
+
+        if (ctx.in_use.load()) {
+            ++m.connections_in_use;
+        }
+        else {
+            ++m.connections_idle;
+        }
+    }
+
+    m.waiting_threads = static_cast<int>(waiters_.size());
+
+    return m;
+}
+
+void connection_pool::record_duration(metric_counters::histogram& _hist, clock_type::duration _duration) noexcept
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(_duration).count();
+    std::size_t bucket = 0;
+
+    while (us > 0 && bucket < _hist.size() - 1) {
+        us >>= 1;
+        ++bucket;
+    }
+
+    _hist[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void connection_pool::release_connection(int _index, clock_type::time_point _checkout_time)
+{
+    record_duration(counters_.hold_time, clock_type::now() - _checkout_time);
+
+    return_connection(_index);
 }
 
 void connection_pool::return_connection(int _index)
 {
-    conn_ctxs_[_index].in_use.store(false);
+    conn_ctxs_[_index].last_used_time = clock_type::now();
+
+    std::lock_guard<std::mutex> lock{waiters_mutex_};
+
+    if (waiters_.empty()) {
+        conn_ctxs_[_index].in_use.store(false);
+        return;
+    }
+
+    // Hand the connection directly to the thread that has waited the longest.
+    // The connection stays marked as in use so that no other thread can take
+    // it before the waiter wakes up.
+    auto* w = waiters_.front();
+    waiters_.pop_front();
+    --waiter_count_;
+
+    w->index = _index;
+    w->cv.notify_one();
 }
 
 } // namespace irods
-
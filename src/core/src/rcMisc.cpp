@@ -25,7 +25,10 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
+#include <array>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <map>
 #include <random>
 #include <openssl/md5.h>
@@ -1335,15 +1338,100 @@ setStateForRestart( rodsRestart_t * rodsRestart, rodsPath_t * targPath,
 
 
 
+// Lookup tables over columnNames[], built at compile time.
+//
+// Names are found through an open-addressing hash table holding indices
+// into columnNames[], sized so that the longest probe sequence stays short.
+// Ids index directly into an array of names.
+namespace {
+    constexpr std::size_t column_hash_table_size = 1024;
+    constexpr int empty_slot = -1;
+
+    static_assert( column_hash_table_size >= 2 * NumOfColumnNames, "column hash table is too full" );
+
+    constexpr std::size_t hash_column_name( std::string_view name ) {
+        // FNV-1a
+        std::uint32_t h = 2166136261u;
+        for ( char c : name ) {
+            h = ( h ^ static_cast<unsigned char>( c ) ) * 16777619u;
+        }
+        return h & ( column_hash_table_size - 1 );
+    }
+
+    constexpr std::size_t next_slot( std::size_t slot ) {
+        return ( slot + 1 ) & ( column_hash_table_size - 1 );
+    }
+
+    struct column_hash_table {
+        std::array<int, column_hash_table_size> slots;
+        int max_probes;
+    };
+
+    constexpr column_hash_table make_column_hash_table() {
+        column_hash_table t{};
+        for ( auto& s : t.slots ) {
+            s = empty_slot;
+        }
+        for ( int i = 0; i < NumOfColumnNames; i++ ) {
+            const std::string_view name{columnNames[i].columnName};
+            auto slot = hash_column_name( name );
+            int probes = 1;
+            // Keeps the first entry of a duplicated name, as the linear scan
+            // this replaces did.
+            while ( t.slots[slot] != empty_slot && name != columnNames[t.slots[slot]].columnName ) {
+                slot = next_slot( slot );
+                probes++;
+            }
+            if ( t.slots[slot] == empty_slot ) {
+                t.slots[slot] = i;
+            }
+            t.max_probes = std::max( t.max_probes, probes );
+        }
+        return t;
+    }
+
+    constexpr auto column_ids_by_name = make_column_hash_table();
+
+    static_assert( column_ids_by_name.max_probes <= 8, "too many collisions in the column hash table" );
+
+    constexpr int max_column_id() {
+        int max_id = 0;
+        for ( int i = 0; i < NumOfColumnNames; i++ ) {
+            max_id = std::max( max_id, columnNames[i].columnId );
+        }
+        return max_id;
+    }
+
+    constexpr std::array<const char*, max_column_id() + 1> make_column_names_by_id() {
+        std::array<const char*, max_column_id() + 1> t{};
+        for ( int i = 0; i < NumOfColumnNames; i++ ) {
+            const int id = columnNames[i].columnId;
+            if ( id >= 0 && !t[id] ) {
+                t[id] = columnNames[i].columnName;
+            }
+        }
+        return t;
+    }
+
+    constexpr auto column_names_by_id = make_column_names_by_id();
+} // anonymous namespace
+
 int
 getAttrIdFromAttrName( char * cname ) {
+    if ( !cname ) {
+        return NO_COLUMN_NAME_FOUND;
+    }
 
-    int i;
-    for ( i = 0; i < NumOfColumnNames ; i++ ) {
-        if ( !strcmp( columnNames[i].columnName, cname ) ) {
-            return columnNames[i].columnId;
+    const std::string_view name{cname};
+    for ( auto slot = hash_column_name( name );
+          column_ids_by_name.slots[slot] != empty_slot;
+          slot = next_slot( slot ) ) {
+        const auto& column = columnNames[column_ids_by_name.slots[slot]];
+        if ( name == column.columnName ) {
+            return column.columnId;
         }
     }
+
     return NO_COLUMN_NAME_FOUND;
 }
 
@@ -1403,14 +1491,12 @@ getSelVal( char * c ) {
 
 char *
 getAttrNameFromAttrId( int cid ) {
-
-    int i;
-    for ( i = 0; i < NumOfColumnNames ; i++ ) {
-        if ( columnNames[i].columnId == cid ) {
-            return columnNames[i].columnName;
-        }
+    if ( cid < 0 || static_cast<std::size_t>( cid ) >= column_names_by_id.size() ) {
+        return NULL;
     }
-    return NULL;
+    // columnNames[] is constexpr, but this C interface has always returned
+    // a non-const pointer.
+    return const_cast<char*>( column_names_by_id[cid] );
 }
 
 int
@@ -0,0 +1,397 @@
+#include "sharded_connection_pool.hpp"
+
+#include "query.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace irods {
+
+using clock_type = connection_pool::clock_type;
+
+sharded_connection_pool::connection_proxy::connection_proxy(std::shared_ptr<connection_pool> _pool,
+                                                            connection_pool::connection_proxy&& _conn,
+                                                            shard& _shard) noexcept
+    : pool_{std::move(_pool)}
+    , conn_{std::move(_conn)}
+    , shard_{&_shard}
+{
+}
+
+sharded_connection_pool::connection_proxy::connection_proxy(connection_proxy&& _other)
+    : pool_{std::move(_other.pool_)}
+    , conn_{std::move(_other.conn_)}
+    , shard_{_other.shard_}
+{
+    _other.shard_ = nullptr;
+}
+
+sharded_connection_pool::connection_proxy& sharded_connection_pool::connection_proxy::operator=(connection_proxy&& _other)
+{
+    if (shard_) {
+        --shard_->in_flight;
+    }
+
+    // The held connection is returned to its pool before the pool itself
+    // is released.
+    conn_ = std::move(_other.conn_);
+    pool_ = std::move(_other.pool_);
+    shard_ = _other.shard_;
+
+    _other.shard_ = nullptr;
+
+    return *this;
+}
+
+sharded_connection_pool::connection_proxy::~connection_proxy()
+{
+    if (shard_) {
+        --shard_->in_flight;
+    }
+}
+
+sharded_connection_pool::connection_proxy::operator rcComm_t&() const noexcept
+{
+    return conn_;
+}
+
+const connection_endpoint& sharded_connection_pool::connection_proxy::endpoint() const noexcept
+{
+    return shard_->endpoint;
+}
+
+clock_type::duration sharded_connection_pool::connection_proxy::wait_time() const noexcept
+{
+    return conn_.wait_time();
+}
+
+void sharded_connection_pool::connection_proxy::report_socket_error() noexcept
+{
+    conn_.report_socket_error();
+}
+
+sharded_connection_pool::sharded_connection_pool(const std::vector<connection_endpoint>& _endpoints,
+                                                 int _size_per_endpoint,
+                                                 const std::string& _username,
+                                                 const std::string& _zone,
+                                                 const int _refresh_time,
+                                                 const sharded_connection_pool_options& _options)
+    : size_{_size_per_endpoint}
+    , username_{_username}
+    , zone_{_zone}
+    , refresh_time_{_refresh_time}
+    , options_{_options}
+    , shards_(_endpoints.size())
+    , maintenance_mutex_{}
+    , maintenance_cv_{}
+    , maintenance_requested_{}
+    , stop_maintenance_{}
+    , maintenance_thread_{}
+{
+    if (_endpoints.empty()) {
+        throw std::runtime_error{"no connection endpoints"};
+    }
+
+    bool connected = false;
+
+    // The pools are created one at a time. Each pool creates its first
+    // connection synchronously, which guarantees that the network plugin
+    // is loaded before connections are made in parallel.
+    for (std::size_t i = 0; i < _endpoints.size(); ++i) {
+        shards_[i].endpoint = _endpoints[i];
+
+        if (connect(shards_[i])) {
+            connected = true;
+        }
+    }
+
+    if (!connected) {
+        throw std::runtime_error{"connect error"};
+    }
+
+    maintenance_thread_ = std::thread{[this] { run_maintenance(); }};
+}
+
+sharded_connection_pool::~sharded_connection_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock{maintenance_mutex_};
+        stop_maintenance_ = true;
+    }
+
+    maintenance_cv_.notify_one();
+    maintenance_thread_.join();
+}
+
+sharded_connection_pool::connection_proxy sharded_connection_pool::get_connection()
+{
+    std::vector<bool> excluded(shards_.size());
+
+    // The best endpoint that had no connection to spare.
+    shard* busy = nullptr;
+
+    // Try every endpoint at most once, without waiting long on any of them.
+    for (std::size_t attempt = 0; attempt < shards_.size(); ++attempt) {
+        auto* s = select_shard(excluded);
+
+        if (!s) {
+            break;
+        }
+
+        excluded[std::distance(shards_.data(), s)] = true;
+
+        auto pool = current_pool(*s);
+
+        if (!pool) {
+            continue;
+        }
+
+        ++s->in_flight;
+
+        try {
+            if (auto conn = pool->get_connection(options_.failover_timeout); conn) {
+                return {std::move(pool), std::move(*conn), *s};
+            }
+
+            --s->in_flight;
+
+            if (!busy) {
+                busy = s;
+            }
+        }
+        catch (const std::exception&) {
+            --s->in_flight;
+            eject(*s, pool);
+        }
+    }
+
+    // Every available endpoint is busy. Wait on the best of them.
+    if (busy) {
+        if (auto pool = current_pool(*busy); pool) {
+            ++busy->in_flight;
+
+            try {
+                auto conn = pool->get_connection();
+                return {std::move(pool), std::move(conn), *busy};
+            }
+            catch (const std::exception&) {
+                --busy->in_flight;
+                eject(*busy, pool);
+            }
+        }
+    }
+
+    throw std::runtime_error{"no connection endpoint available"};
+}
+
+sharded_connection_pool::shard* sharded_connection_pool::select_shard(const std::vector<bool>& _excluded)
+{
+    // Returns true if "_lhs" is a better choice than "_rhs".
+    const auto better = [this](const shard& _lhs, const shard& _rhs) {
+        const auto lhs_load = _lhs.in_flight.load();
+        const auto rhs_load = _rhs.in_flight.load();
+        const auto lhs_latency = _lhs.latency_us.load();
+        const auto rhs_latency = _rhs.latency_us.load();
+
+        if (routing_policy::lowest_latency == options_.policy) {
+            return lhs_latency < rhs_latency || (lhs_latency == rhs_latency && lhs_load < rhs_load);
+        }
+
+        return lhs_load < rhs_load || (lhs_load == rhs_load && lhs_latency < rhs_latency);
+    };
+
+    shard* best = nullptr;
+
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        auto& s = shards_[i];
+
+        if (_excluded[i] || s.reconnecting.load()) {
+            continue;
+        }
+
+        if (!best || better(s, *best)) {
+            best = &s;
+        }
+    }
+
+    return best;
+}
+
+std::shared_ptr<connection_pool> sharded_connection_pool::current_pool(shard& _shard)
+{
+    std::lock_guard<std::mutex> lock{_shard.mutex};
+    return _shard.pool;
+}
+
+bool sharded_connection_pool::connect(shard& _shard)
+{
+    // Called by the constructor and then only by the maintenance thread.
+    // The pool is built without holding the shard's mutex, so checkouts
+    // never wait for the endpoint to connect.
+    std::shared_ptr<connection_pool> pool;
+
+    try {
+        pool = std::make_shared<connection_pool>(size_,
+                                                 _shard.endpoint.host,
+                                                 _shard.endpoint.port,
+                                                 username_,
+                                                 zone_,
+                                                 refresh_time_,
+                                                 options_.pool_options);
+    }
+    catch (const std::exception&) {
+        std::lock_guard<std::mutex> lock{_shard.mutex};
+        schedule_retry(_shard);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{_shard.mutex};
+
+    _shard.pool = std::move(pool);
+    _shard.backoff = {};
+
+    // The endpoint may have moved or recovered, so measure it afresh.
+    _shard.latency_us.store(0);
+    _shard.next_probe_time = {};
+
+    _shard.reconnecting.store(false);
+
+    return true;
+}
+
+void sharded_connection_pool::eject(shard& _shard, const std::shared_ptr<connection_pool>& _pool)
+{
+    {
+        std::lock_guard<std::mutex> lock{_shard.mutex};
+
+        // Another thread may have ejected the endpoint already, and the
+        // maintenance thread may have reconnected it since.
+        if (_shard.pool != _pool) {
+            return;
+        }
+
+        // Connections that are still checked out keep the old pool alive.
+        _shard.pool.reset();
+        schedule_retry(_shard);
+    }
+
+    // Let the maintenance thread know when to reconnect.
+    {
+        std::lock_guard<std::mutex> lock{maintenance_mutex_};
+        maintenance_requested_ = true;
+    }
+
+    maintenance_cv_.notify_one();
+}
+
+void sharded_connection_pool::schedule_retry(shard& _shard)
+{
+    // Must be called while holding the shard's mutex.
+
+    _shard.backoff = (_shard.backoff.count() == 0)
+        ? options_.initial_backoff
+        : std::min(_shard.backoff * 2, options_.max_backoff);
+
+    _shard.retry_time = clock_type::now() + _shard.backoff;
+    _shard.reconnecting.store(true);
+}
+
+void sharded_connection_pool::run_maintenance()
+{
+    std::unique_lock<std::mutex> lock{maintenance_mutex_};
+
+    while (true) {
+        maintenance_cv_.wait_until(lock, next_maintenance_time(), [this] {
+            return stop_maintenance_ || maintenance_requested_;
+        });
+
+        if (stop_maintenance_) {
+            break;
+        }
+
+        maintenance_requested_ = false;
+        lock.unlock();
+
+        const auto now = clock_type::now();
+
+        for (auto& s : shards_) {
+            if (s.reconnecting.load()) {
+                std::unique_lock<std::mutex> shard_lock{s.mutex};
+                const auto due = now >= s.retry_time;
+                shard_lock.unlock();
+
+                if (due) {
+                    connect(s);
+                }
+            }
+            else if (now >= s.next_probe_time) {
+                probe_latency(s);
+            }
+        }
+
+        lock.lock();
+    }
+}
+
+clock_type::time_point sharded_connection_pool::next_maintenance_time()
+{
+    auto next = clock_type::time_point::max();
+
+    for (auto& s : shards_) {
+        if (s.reconnecting.load()) {
+            std::lock_guard<std::mutex> lock{s.mutex};
+            next = std::min(next, s.retry_time);
+        }
+        else {
+            next = std::min(next, s.next_probe_time);
+        }
+    }
+
+    return next;
+}
+
+void sharded_connection_pool::probe_latency(shard& _shard)
+{
+    _shard.next_probe_time = clock_type::now() + options_.latency_probe_interval;
+
+    auto pool = current_pool(_shard);
+
+    if (!pool) {
+        return;
+    }
+
+    // A busy endpoint is measured on the next round rather than holding up
+    // the threads waiting for its connections.
+    auto conn = pool->try_get_connection();
+
+    if (!conn) {
+        return;
+    }
+
+    // The same query the connection pool uses to verify connections. Its
+    // duration is dominated by the network round trip to the endpoint.
+    try {
+        const auto start = clock_type::now();
+        query<rcComm_t>{&static_cast<rcComm_t&>(*conn), "select ZONE_NAME where ZONE_TYPE = 'local'"};
+        record_latency(_shard, clock_type::now() - start);
+    }
+    catch (const std::exception&) {
+        // Have the connection pool replace the connection.
+        conn->report_socket_error();
+    }
+}
+
+void sharded_connection_pool::record_latency(shard& _shard, clock_type::duration _latency) noexcept
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+
+    // Exponentially weighted moving average, seeded by the first sample.
+    // Concurrent updates may lose a sample, which is acceptable for routing
+    // decisions.
+    const auto sample = std::max<std::int64_t>(duration_cast<microseconds>(_latency).count(), 1);
+    const auto average = _shard.latency_us.load();
+    _shard.latency_us.store(average == 0 ? sample : average + (sample - average) / 8);
+}
+
+} // namespace irods
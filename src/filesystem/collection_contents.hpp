@@ -0,0 +1,60 @@
+#ifndef IRODS_FILESYSTEM_COLLECTION_CONTENTS_HPP
+#define IRODS_FILESYSTEM_COLLECTION_CONTENTS_HPP
+
+// Internal to the filesystem library. Shared by filesystem.cpp and
+// recursive_collection_iterator.cpp.
+
+#include "filesystem/path.hpp"
+#include "filesystem/collection_iterator.hpp"
+
+#include "typed_query.hpp"
+
+#include <string>
+#include <tuple>
+
+namespace irods::experimental::filesystem::NAMESPACE_IMPL
+{
+    // Special collections (mounted or linked) keep their contents outside
+    // of the catalog.
+    inline auto is_special_collection(rxComm& _comm, const path& _p) -> bool
+    {
+        namespace gq = irods::experimental::genquery;
+
+        bool special = false;
+
+        gq::select<COL_COLL_TYPE>()
+            .where(gq::col<COL_COLL_NAME> == _p.string())
+            .execute(&_comm, [&special](const auto& _row) {
+                special = !std::get<0>(_row).empty();
+            }, 1);
+
+        return special;
+    }
+
+    // Probes the catalog directly for the contents of a path known to be a
+    // collection, without stat'ing it first.
+    inline auto is_collection_empty(rxComm& _comm, const path& _p) -> bool
+    {
+        namespace gq = irods::experimental::genquery;
+
+        const auto p = _p.string();
+
+        // The root collection is its own parent, so it is excluded from
+        // the subcollection probe.
+        if (gq::has_rows(&_comm, gq::col<COL_D_DATA_ID>, {gq::col<COL_COLL_NAME> == p}) ||
+            gq::has_rows(&_comm, gq::col<COL_COLL_ID>, {gq::col<COL_COLL_PARENT_NAME> == p, gq::col<COL_COLL_NAME> != p}))
+        {
+            return false;
+        }
+
+        // The catalog does not list the contents of special collections,
+        // so only opening them tells whether they are empty.
+        if (is_special_collection(_comm, _p)) {
+            return collection_iterator{} == collection_iterator{_comm, _p};
+        }
+
+        return true;
+    }
+} // irods::experimental::filesystem::NAMESPACE_IMPL
+
+#endif // IRODS_FILESYSTEM_COLLECTION_CONTENTS_HPP
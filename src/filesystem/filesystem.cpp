@@ -49,6 +49,9 @@
 #include "irods_error.hpp"
 #include "irods_exception.hpp"
 #include "query.hpp"
+#include "typed_query.hpp"
+#include "query_cache.hpp"
+#include "collection_contents.hpp"
 #include "irods_at_scope_exit.hpp"
 
 #include <iostream>
@@ -94,6 +97,14 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
             return {_ec, std::system_category()};
         }
 
+        // Drops cached query results that may refer to "_p". A query can
+        // refer to "_p" without naming it (e.g. by DATA_ID or through a
+        // "like" pattern on an ancestor), so every entry is dropped.
+        auto invalidate_cached_queries(const path&) -> void
+        {
+            irods::query_cache::invalidate_all({});
+        }
+
         struct stat
         {
             int error;
@@ -181,11 +192,6 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
             return s;
         }
 
-        auto is_collection_empty(rxComm& _comm, const path& _p) -> bool
-        {
-            return collection_iterator{} == collection_iterator{_comm, _p};
-        }
-
         struct remove_impl_options
         {
             bool no_trash  = false;
@@ -211,7 +217,10 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
                     addKeyVal(&input.condInput, FORCE_FLAG_KW, "");
                 }
 
-                return rxDataObjUnlink(&_comm, &input) == 0;
+                const auto ec = rxDataObjUnlink(&_comm, &input);
+                invalidate_cached_queries(_p);
+
+                return ec == 0;
             }
 
             if (is_collection(s)) {
@@ -232,7 +241,10 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
                 }
 
                 constexpr int verbose = 0;
-                return rxRmColl(&_comm, &input, verbose) >= 0;
+                const auto ec = rxRmColl(&_comm, &input, verbose);
+                invalidate_cached_queries(_p);
+
+                return ec >= 0;
             }
 
             throw filesystem_error{"cannot remove: unknown object type", _p};
@@ -577,22 +589,31 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
 
     auto remove_all(rxComm& _comm, const path& _p, remove_options _opts) -> std::uintmax_t
     {
-        std::string data_obj_sql = "select count(DATA_ID) where COLL_NAME like '";
-        data_obj_sql += _p;
-        data_obj_sql += "%'";
+        namespace gq = irods::experimental::genquery;
 
-        std::string colls_sql = "select count(COLL_ID) where COLL_NAME like '";
-        colls_sql += _p;
-        colls_sql += "%'";
+        if (_p.empty()) {
+            throw filesystem_error{"empty path"};
+        }
 
-        std::uintmax_t count = 0;
+        auto descendants = _p.string();
 
-        for (const auto& sql : {data_obj_sql, colls_sql}) {
-            for (const auto& row : irods::query{&_comm, sql}) {
-                count += std::stoull(row[0]);
-            }
+        if (!detail::is_separator(descendants.back())) {
+            descendants += path::separator;
         }
 
+        descendants += '%';
+
+        // Matches "_p" and everything under it, but not siblings that merely
+        // share its name as a prefix.
+        const auto in_tree = gq::col<COL_COLL_NAME> == _p.string() || gq::like(gq::col<COL_COLL_NAME>, descendants);
+
+        // Data object and collection counts are separate queries because a
+        // combined query would only see collections containing data objects.
+        const auto data_objects = gq::aggregate_query(&_comm, {gq::count(gq::col<COL_D_DATA_ID>)}, {in_tree});
+        const auto collections = gq::aggregate_query(&_comm, {gq::count(gq::col<COL_COLL_ID>)}, {in_tree});
+
+        const std::uintmax_t count = data_objects[0] + collections[0];
+
         if (0 == count) {
             return 0;
         }
@@ -655,7 +676,10 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
 
         input.accessLevel = access;
 
-        if (const auto ec = rxModAccessControl(&_comm, &input); ec != 0) {
+        const auto ec = rxModAccessControl(&_comm, &input);
+        invalidate_cached_queries(_p);
+
+        if (ec != 0) {
             throw filesystem_error{"cannot set permissions", _p, make_error_code(ec)};
         }
     }
@@ -729,7 +753,11 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
         std::strncpy(input.srcDataObjInp.objPath, _old_p.c_str(), std::strlen(_old_p.c_str()));
         std::strncpy(input.destDataObjInp.objPath, _new_p.c_str(), std::strlen(_new_p.c_str()));
 
-        if (const auto ec = rxDataObjRename(&_comm, &input); ec < 0) {
+        const auto ec = rxDataObjRename(&_comm, &input);
+        invalidate_cached_queries(_old_p);
+        invalidate_cached_queries(_new_p);
+
+        if (ec < 0) {
             throw filesystem_error{"cannot rename object", _old_p, _new_p, make_error_code(ec)};
         }
     }
@@ -785,17 +813,17 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
             }
         }
 
-        std::vector<checksum> checksums;
+        namespace gq = irods::experimental::genquery;
 
-        std::string sql = "select DATA_REPL_NUM, DATA_CHECKSUM, DATA_SIZE, DATA_REPL_STATUS where DATA_NAME = '";
-        sql += _p.object_name();
-        sql += "' and COLL_NAME = '";
-        sql += _p.parent_path();
-        sql += "'";
+        std::vector<checksum> checksums;
 
-        for (const auto& row : irods::query{&_comm, sql}) {
-            checksums.push_back({std::stoi(row[0]), row[1], std::stoull(row[2]), row[3] == "1"});
-        }
+        gq::select<COL_DATA_REPL_NUM, COL_D_DATA_CHECKSUM, COL_DATA_SIZE, COL_D_REPL_STATUS>()
+            .where(gq::col<COL_DATA_NAME> == _p.object_name().string())
+            .where(gq::col<COL_COLL_NAME> == _p.parent_path().string())
+            .execute(&_comm, [&checksums](const auto& _row) {
+                const auto& [repl_num, value, size, repl_status] = _row;
+                checksums.push_back({static_cast<int>(repl_num), std::string{value}, static_cast<std::uintmax_t>(size), 1 == repl_status});
+            });
 
         return checksums;
     }
@@ -878,7 +906,7 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
         std::vector<metadata> results;
 
         for (const auto& row : irods::query{&_comm, sql}) {
-            results.push_back({row[0], row[1], row[2]});
+            results.push_back({std::string{row[0]}, std::string{row[1]}, std::string{row[2]}});
         }
 
         return results;
@@ -928,7 +956,10 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
         std::strncpy(units_buf, units.c_str(), units.size());
         input.arg5 = units_buf;
 
-        if (const auto ec = rxModAVUMetadata(&_comm, &input); ec != 0) {
+        const auto ec = rxModAVUMetadata(&_comm, &input);
+        invalidate_cached_queries(_p);
+
+        if (ec != 0) {
             throw filesystem_error{"cannot set metadata", _p, make_error_code(ec)};
         }
 
@@ -979,7 +1010,10 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
         std::strncpy(units_buf, units.c_str(), units.size());
         input.arg5 = units_buf;
 
-        if (const auto ec = rxModAVUMetadata(&_comm, &input); ec != 0) {
+        const auto ec = rxModAVUMetadata(&_comm, &input);
+        invalidate_cached_queries(_p);
+
+        if (ec != 0) {
             throw filesystem_error{"cannot remove metadata", _p, make_error_code(ec)};
         }
 
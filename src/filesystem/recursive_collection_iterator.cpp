@@ -2,6 +2,8 @@
 
 #include "filesystem/filesystem_error.hpp"
 
+#include "collection_contents.hpp"
+
 #include <iostream>
 
 namespace irods::experimental::filesystem::NAMESPACE_IMPL
@@ -29,7 +31,7 @@ namespace irods::experimental::filesystem::NAMESPACE_IMPL
 
         if (iter->is_collection() && ctx_->recurse) {
             // Add the collection to the stack only if it is not empty.
-            if (!is_empty(*iter.connection(), iter->path()))
+            if (!is_collection_empty(*iter.connection(), iter->path()))
             {
                 added_new_collection = true;
                 auto* conn = iter.connection();